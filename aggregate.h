@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+
+// == Агрегаты поддеревьев ==
+// Моноид: ассоциативная операция combine с нейтральным элементом identity
+// Значение агрегата для узла: combine(агрегат левого, lift(значение), агрегат правого)
+// Интерфейс моноида:
+//   using Value = ...;                                     - тип агрегата
+//   static Value identity();                               - агрегат пустого поддерева
+//   static Value lift(const T &x);                         - агрегат одного значения
+//   static Value combine(const Value &a, const Value &b);  - агрегат подряд идущих частей
+
+// Без агрегата (по умолчанию): в узлах ничего не хранится и не пересчитывается
+template <typename T>
+struct NoAggregate {
+  struct Value {};
+  static Value identity() {
+    return {};
+  }
+  static Value lift(const T &) {
+    return {};
+  }
+  static Value combine(const Value &, const Value &) {
+    return {};
+  }
+};
+
+// Сумма значений
+template <typename T>
+struct SumAggregate {
+  using Value = T;
+  static Value identity() {
+    return T();
+  }
+  static Value lift(const T &x) {
+    return x;
+  }
+  static Value combine(const Value &a, const Value &b) {
+    return a + b;
+  }
+};
+
+// Минимум значений
+template <typename T>
+struct MinAggregate {
+  using Value = T;
+  static Value identity() {
+    return std::numeric_limits<T>::max();
+  }
+  static Value lift(const T &x) {
+    return x;
+  }
+  static Value combine(const Value &a, const Value &b) {
+    return std::min(a, b);
+  }
+};
+
+// Максимум значений
+template <typename T>
+struct MaxAggregate {
+  using Value = T;
+  static Value identity() {
+    return std::numeric_limits<T>::lowest();
+  }
+  static Value lift(const T &x) {
+    return x;
+  }
+  static Value combine(const Value &a, const Value &b) {
+    return std::max(a, b);
+  }
+};
+
+// Количество значений
+template <typename T>
+struct CountAggregate {
+  using Value = long long;
+  static Value identity() {
+    return 0;
+  }
+  static Value lift(const T &) {
+    return 1;
+  }
+  static Value combine(const Value &a, const Value &b) {
+    return a + b;
+  }
+};
+
+// Место под агрегат в узле; для пустого агрегата (NoAggregate) узел не увеличивается
+template <typename Monoid, bool Empty = std::is_empty<typename Monoid::Value>::value>
+struct AggregateHolder {
+  typename Monoid::Value aggregate = Monoid::identity();
+};
+template <typename Monoid>
+struct AggregateHolder<Monoid, true> {};
@@ -5,11 +5,27 @@
 #include <codecvt>
 #include <cstring>
 #include <iostream>
+#include <limits>
 #include <locale>
+#include <memory>
 #include <set>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "aggregate.h"
 #include "common.hpp"
+#include "formatprogram.h"
+#include "frozentree.h"
+#include "mappedtree.h"
+#include "nodepool.h"
+#include "persistenttree.h"
+#include "serialization.h"
+#include "structurehash.h"
+#include "text.h"
+#include "threadpool.h"
+#include "traversal.h"
 
 #ifdef DEBUG_BUILD
 #define CHECK(tree) check(tree)
@@ -24,130 +40,317 @@ using namespace std;
 // для каждой его вершины высота её двух поддеревьев различается не более чем на 1.
 // АВЛ — аббревиатура, образованная первыми буквами фамилий создателей (советских учёных):
 // Георгия Максимовича Адельсон-Вельского и Евгения Михайловича Ландиса
-template <typename T>
+// Monoid - агрегат, который хранится для каждого поддерева (см. aggregate.h)
+template <typename T, typename Monoid = NoAggregate<T>>
 struct BinaryTree {
+  using Aggregate = typename Monoid::Value;
   struct Node;        // Узел дерева
   struct Operation {  // Абстрактный класс - операция которую можно проделать с узлом дерева
     virtual void apply(Node *n) = 0;  // n - узел
   };
   // Узел дерева
-  struct Node {
+  struct Node : AggregateHolder<Monoid> {
     T value;                // Данные в узле
     Node *left = nullptr;   // Левое поддерево
     Node *right = nullptr;  // Правое поддерево
     Node *next = nullptr;  // Для прошивки дерева: следующая вершина в порядке обхода дерева
+    Node *prev = nullptr;  // В режиме связей (keepLinks): предыдущая вершина по возрастанию
     int height = 1;  // Высота поддерева с корнем в этой вершине
     int dis = 0;     // Дисбаланс (+1, 0, -1 - для сбалансированного дерева - AVL)
-    // Если меняем что-то в поддеревьях данной вершины, то высота и дисбаланс могут меняться
-    // Пересчитываем высоту и дисбаланс считая что для поддеревьев уже подсчитано
+    int count = 1;   // Количество узлов в поддереве с корнем в этой вершине
+    uint64_t hash = StructureHash::EMPTY;  // Структурный хеш поддерева: форма и значения (см. structurehash.h)
+    // Если меняем что-то в поддеревьях данной вершины, то высота, дисбаланс и размер могут меняться
+    // Пересчитываем их считая что для поддеревьев уже подсчитано
     void reCalc() {
       int leftHeight = (left) ? left->height : 0;
       int rightHeight = (right) ? right->height : 0;
       height = std::max(leftHeight, rightHeight) + 1;  // Высота поддерева с корнем в этой вершине
       dis = leftHeight - rightHeight;  // Запоминаем дисбаланс для данной вершины
+      count = ((left) ? left->count : 0) + 1 + ((right) ? right->count : 0);
+      hash = StructureHash::combine(hashOf(left), StructureHash::ofValue(value), hashOf(right));
+      if constexpr (!std::is_empty<Aggregate>::value) {
+        this->aggregate = Monoid::combine(Monoid::combine(aggregateOf(left), Monoid::lift(value)), aggregateOf(right));
+      }
     }
     // Создание узла, параметры: значение и родитель
-    explicit Node(T value, Node *left = nullptr, Node *right = nullptr) : value(value), left(left), right(right) {
+    explicit Node(T value, Node *left = nullptr, Node *right = nullptr)
+        : value(std::move(value)), left(left), right(right) {
+      reCalc();
+    }
+    // Значение создаётся прямо в узле из параметров его конструктора
+    template <class... Args>
+    explicit Node(std::in_place_t, Args &&...args) : value(std::forward<Args>(args)...) {
       reCalc();
     }
-    // == Обходы ==
+    // == Обходы == (без рекурсии, см. traversal.h)
     // 1. КЛП = Корень Левый Правый
     void NLR(Operation &op) {
-      op.apply(this);
-      if (left) left->NLR(op);
-      if (right) right->NLR(op);
+      traverse<Order::NLR>(this, [&](Node *n) { op.apply(n); });
     }
     // 2. КПЛ = Корень Правый Левый
     void NRL(Operation &op) {
-      op.apply(this);
-      if (right) right->NRL(op);
-      if (left) left->NRL(op);
+      traverse<Order::NRL>(this, [&](Node *n) { op.apply(n); });
     }
     // 3. ЛПК = Левый Правый Корень
     void LRN(Operation &op) {
-      if (left) left->LRN(op);
-      if (right) right->LRN(op);
-      op.apply(this);
+      traverse<Order::LRN>(this, [&](Node *n) { op.apply(n); });
     }
     // 4. ЛКП = Левый Корень Правый
     void LNR(Operation &op) {
-      if (left) left->LNR(op);
-      op.apply(this);
-      if (right) right->LNR(op);
+      traverse<Order::LNR>(this, [&](Node *n) { op.apply(n); });
     }
     // 5. ПЛК = Правый Левый Корень
     void RLN(Operation &op) {
-      if (right) right->RLN(op);
-      if (left) left->RLN(op);
-      op.apply(this);
+      traverse<Order::RLN>(this, [&](Node *n) { op.apply(n); });
     }
     // 6. ПКЛ = Правый Корень Левый
     void RNL(Operation &op) {
-      if (right) right->RNL(op);
-      op.apply(this);
-      if (left) left->RNL(op);
-    }
-    void print(const char *format, std::ostream &os) {
-      if (!left && !right) {
-        os << value;
-        return;
-      }
-      for (size_t i = 0, len = strlen(format); i < len; i++) {
-        switch (format[i]) {
-        case 'N':
-          os << value;
-          break;
-        case 'L':
-          if (left) left->print(format, os);
-          break;
-        case 'R':
-          if (right) right->print(format, os);
-          break;
-        default:
-          os << format[i];
-        }
-      }
+      traverse<Order::RNL>(this, [&](Node *n) { op.apply(n); });
     }
   };
 
+ public:
+  // Предельная высота АВЛ-дерева: дереву высоты 64 нужно больше 10^13 узлов
+  // Столько места достаточно для стека пути от корня до любого узла
+  static constexpr int MAX_HEIGHT = 64;
+
  private:
   Node *root = nullptr;  // Корень дерева
   int size = 0;          // Количество узлов в дереве
-  // Рекурсивное удаление дерева со всеми поддеревьями
-  void delTree(Node *tree) {
-    if (tree == nullptr) return;
-    delTree(tree->left);
-    delTree(tree->right);
-    delete tree;
+  // Память под узлы дерева. Деревья, полученные разделением (split), делят один пул,
+  // поэтому их нельзя изменять одновременно из разных потоков
+  std::shared_ptr<NodePool<Node>> pool = std::make_shared<NodePool<Node>>();
+  NodePool<Node> &nodes() {
+    if (!pool) pool = std::make_shared<NodePool<Node>>();  // Пул был отдан при перемещении дерева
+    return *pool;
   }
-  // Проходим в порядке: Корень Левый Правый
-  void NLR(Node *n, Operation &op) {
-    if (n == nullptr) return;
-    op.apply(n);        // Применяем операцию к корню
-    NLR(n->left, op);   // Вызываем обход для левого
-    NLR(n->right, op);  // Вызываем обход для правого
+  // Индекс всех поддеревьев по структурному хешу - строится при первом поиске поддерева (containsSubtree)
+  // и сбрасывается при любом изменении дерева
+  using ShapeIndex = std::unordered_multimap<uint64_t, const Node *>;
+  std::unique_ptr<ShapeIndex> shapes;
+  void structureChanged() {
+    shapes.reset();
   }
-  // Обход в заданным строкой порядке с применением операции
-  void go(Node *n, const char *order, Operation &op) {
-    if (n == nullptr) return;
-    for (size_t i = 0, len = strlen(order); i < len; i++) {
-      switch (order[i]) {
-      case 'L':
-        go(n->left, order, op);
-        break;
-      case 'R':
-        go(n->right, order, op);
-        break;
-      case 'N':
-        op.apply(n);
-        break;
+  // Удаление дерева со всеми поддеревьями без рекурсии и без стека:
+  // левое поддерево поворотом переносим наверх, пока у корня не останется только правое
+  void delTree(Node *tree) {
+    while (tree != nullptr) {
+      if (tree->left) {
+        Node *l = tree->left;
+        tree->left = l->right;
+        l->right = tree;
+        tree = l;
+      } else {
+        Node *r = tree->right;
+        pool->destroy(tree);
+        tree = r;
       }
     }
   }
+  // Удаление всех узлов дерева
+  void clear() {
+    // Для тривиально разрушаемых значений достаточно вернуть блоки пула - O(количество блоков)
+    if (pool && pool.use_count() == 1 && pool->pooled() && std::is_trivially_destructible<T>::value)
+      pool->release();
+    else
+      delTree(root);
+    root = nullptr;
+    size = 0;
+    first = last = nullptr;
+    structureChanged();
+  }
   // Копирование поддерева
-  Node *copy(Node *n) {
-    if (n == nullptr) return nullptr;
-    return new Node(n->value, copy(n->left), copy(n->right));
+  // Идём по левым веткам, правые поддеревья откладываем в стек (не больше высоты дерева)
+  Node *copy(const Node *n) {
+    struct Pending {
+      const Node *from;  // Что копируем
+      Node **to;         // Куда подвешиваем копию
+    };
+    Pending stack[MAX_HEIGHT];
+    int top = 0;
+    Node *res = nullptr;
+    if (n) stack[top++] = {n, &res};
+    while (top > 0) {
+      Pending p = stack[--top];
+      for (const Node *from = p.from; from != nullptr; from = from->left) {
+        Node *c = nodes().create(*from);  // Копируем значение и все поля, посчитанные для поддерева
+        c->left = c->right = c->next = c->prev = nullptr;
+        *p.to = c;
+        if (from->right) {
+          assert(top < MAX_HEIGHT);
+          stack[top++] = {from->right, &c->right};
+        }
+        p.to = &c->left;
+      }
+    }
+    return res;
+  }
+  // Построение идеально сбалансированного дерева из count отсортированных значений
+  // Значения читаются по порядку, каждый узел создаётся один раз => O(count)
+  template <class It>
+  Node *build(It &it, int count) {
+    if (count == 0) return nullptr;
+    Node *left = build(it, count / 2);  // В левом поддереве не меньше узлов, чем в правом
+    Node *n = nodes().create(*it, left);
+    ++it;
+    n->right = build(it, count - count / 2 - 1);
+    n->reCalc();
+    return n;
+  }
+  // Дерево той же формы, что поддерево n другого дерева, со значениями f(x) - O(размер поддерева)
+  // f должна строго возрастать (см. mapMonotone). f вызывается по возрастанию x:
+  // узел создаётся после своего левого поддерева, а reCalc - после правого.
+  // Рекурсия заменена стеком узлов, у которых ещё не достроено поддерево (не больше высоты дерева)
+  template <class SrcNode, class F>
+  Node *copyMapped(const SrcNode *n, F &f) {
+    struct Pending {
+      const SrcNode *from;  // Что копируем
+      Node *made;           // Копия; nullptr - ещё строится левое поддерево
+    };
+    Pending stack[MAX_HEIGHT];
+    int top = 0;
+    Node *done = nullptr;  // Последнее достроенное поддерево
+#ifdef DEBUG_BUILD
+    const SrcNode *prevFrom = nullptr;  // Предыдущее значение и его образ - для проверки монотонности f
+    const Node *prevMade = nullptr;
+#endif
+    const SrcNode *from = n;
+    while (true) {
+      for (; from != nullptr; from = from->left) {
+        assert(top < MAX_HEIGHT);
+        stack[top++] = {from, nullptr};
+      }
+      done = nullptr;
+      while (top > 0 && from == nullptr) {
+        Pending &p = stack[top - 1];
+        if (p.made == nullptr) {  // Левое поддерево готово: создаём узел и идём в правое
+          p.made = nodes().create(f(p.from->value), done);
+#ifdef DEBUG_BUILD
+          assert(!prevFrom || !(prevFrom->value < p.from->value) || prevMade->value < p.made->value);
+          prevFrom = p.from;
+          prevMade = p.made;
+#endif
+          from = p.from->right;
+          done = nullptr;
+          continue;
+        }
+        p.made->right = done;  // Правое поддерево готово
+        p.made->reCalc();
+        done = p.made;
+        top--;
+      }
+      if (from == nullptr) return done;
+    }
+  }
+  template <typename, typename>
+  friend struct BinaryTree;  // Для map в дерево с другим типом значений
+  // map в дерево BinaryTree<U, M>: результаты собираются по порядку, сортируются,
+  // затем строится сбалансированное дерево за O(n)
+  template <class U, class M, class F>
+  BinaryTree<U, M> mapTo(F &f) const {
+    vector<U> values;
+    values.reserve(size);
+    for (const T &x : *this) values.push_back(f(x));
+    std::sort(values.begin(), values.end());
+    BinaryTree<U, M> res;
+    res.buildFromSorted(values.begin(), (int)values.size());
+    return res;
+  }
+  // Замена ребёнка: path[depth - 1] - родитель n (при depth == 0 n - корень)
+  void replaceChild(Node **path, int depth, Node *n, Node *child) {
+    if (depth == 0)
+      root = child;
+    else if (path[depth - 1]->left == n)
+      path[depth - 1]->left = child;
+    else
+      path[depth - 1]->right = child;
+  }
+  // Подъём по пути после вставки или удаления: балансируем, пока высота поддеревьев меняется
+  // Выше высоты не меняются => вращения не нужны, только пересчитываем поля узлов (размеры)
+  void fixPath(Node **path, int depth) {
+    bool rebalance = true;
+    for (int i = depth - 1; i >= 0; i--) {
+      Node *n = path[i];
+      if (!rebalance) {
+        n->reCalc();
+        continue;
+      }
+      int oldHeight = n->height;  // Высота до изменения
+      Node *b = balance(n);
+      if (b != n) replaceChild(path, i, n, b);
+      if (b->height == oldHeight) rebalance = false;
+    }
+  }
+  // Подвесить созданный узел n на место по его значению и сбалансировать дерево
+  // Спускаемся без рекурсии, запоминая путь, затем поднимаемся и балансируем
+  void attach(Node *n) {
+    Node *path[MAX_HEIGHT];
+    int depth = 0;
+    Node **link = &root;  // Куда подвесить новый узел
+    Node *before = nullptr, *after = nullptr;  // Соседи нового узла по возрастанию
+    while (*link) {
+      assert(depth < MAX_HEIGHT);
+      Node *p = path[depth++] = *link;
+      // Если значение <= значению в узле, добавляем в левое поддерево, иначе - в правое
+      if (n->value <= p->value) {
+        after = p;
+        link = &p->left;
+      } else {
+        before = p;
+        link = &p->right;
+      }
+    }
+    *link = n;
+    if (linked) linkBetween(n, before, after);
+    structureChanged();
+    size++;  // Увеличиваем размер дерева
+    fixPath(path, depth);
+  }
+  // Вставка, если такого значения ещё нет; value копируется или перемещается в узел
+  template <class V>
+  std::pair<Node *, bool> insertUniqueValue(V &&value) {
+    Node *path[MAX_HEIGHT];
+    int depth = 0;
+    Node **link = &root;
+    Node *before = nullptr, *after = nullptr;
+    while (*link) {
+      assert(depth < MAX_HEIGHT);
+      Node *n = path[depth++] = *link;
+      if (value < n->value) {
+        after = n;
+        link = &n->left;
+      } else if (n->value < value) {
+        before = n;
+        link = &n->right;
+      } else {
+        return {n, false};  // Уже есть
+      }
+    }
+    Node *created = *link = nodes().create(std::forward<V>(value));
+    if (linked) linkBetween(created, before, after);
+    structureChanged();
+    size++;
+    fixPath(path, depth);  // Вращения перевешивают узлы, но не перемещают их => created остаётся верным
+    return {created, true};
+  }
+  // Вставить узел n в список по возрастанию между before и after (nullptr - край списка)
+  void linkBetween(Node *n, Node *before, Node *after) {
+    n->prev = before;
+    n->next = after;
+    (before ? before->next : first) = n;
+    (after ? after->prev : last) = n;
+  }
+  // Исключить узел n из списка по возрастанию
+  void unlink(Node *n) {
+    (n->prev ? n->prev->next : first) = n->next;
+    (n->next ? n->next->prev : last) = n->prev;
+  }
+  // Края списка после разделения: first и last - минимум и максимум, внешние связи обрезаются
+  void relinkEnds() {
+    first = root ? minimum(root) : nullptr;
+    last = root ? maximum(root) : nullptr;
+    if (first) first->prev = nullptr;
+    if (last) last->next = nullptr;
   }
   // Вставка: добавляем вершину в дерево поиска
   // n - корень поддерева куда добавляем
@@ -157,33 +360,406 @@ struct BinaryTree {
       if (n->left)                       // Если левое поддерево уже есть
         n->left = insertTo(n->left, v);  // Тогда добавляем в него
       else
-        n->left = new Node(v);  // Создаём новый узел со значением v
+        n->left = nodes().create(v);  // Создаём новый узел со значением v
     } else {                    // Если больше, то добавляем вправо
       if (n->right) {           // Если правое поддерево уже есть
         n->right = insertTo(n->right, v);
       } else
-        n->right = new Node(v);
+        n->right = nodes().create(v);
     }
     return balance(n);  // Чтобы дерево оставалось сбалансированным
   }
-  explicit BinaryTree(Node *root) : root(root) {
-    this->size = subTreeSize(root);
-    check(root);
+  // Агрегат поддерева (для пустого - нейтральный элемент)
+  static Aggregate aggregateOf(const Node *n) {
+    if constexpr (std::is_empty<Aggregate>::value) {
+      return Aggregate();
+    } else {
+      return n ? n->aggregate : Monoid::identity();
+    }
+  }
+  // Структурный хеш поддерева (для пустого - StructureHash::EMPTY)
+  static uint64_t hashOf(const Node *n) {
+    return n ? n->hash : StructureHash::EMPTY;
+  }
+  // == Разделение и соединение поддеревьев за O(log n) ==
+  static int heightOf(const Node *n) {
+    return n ? n->height : 0;
+  }
+  // Соединение: все значения l <= k->value <= все значения r, k - отдельный узел
+  Node *joinNodes(Node *l, Node *k, Node *r) {
+    int hl = heightOf(l), hr = heightOf(r);
+    if (hl > hr + 1) return joinRight(l, k, r);
+    if (hr > hl + 1) return joinLeft(l, k, r);
+    k->left = l;  // Высоты отличаются не больше чем на 1 => k - корень
+    k->right = r;
+    k->reCalc();
+    return k;
+  }
+  // l выше r: спускаемся по правой ветке l до поддерева высоты не больше h(r) + 1
+  Node *joinRight(Node *l, Node *k, Node *r) {
+    if (heightOf(l->right) <= heightOf(r) + 1) {
+      k->left = l->right;
+      k->right = r;
+      k->reCalc();
+      l->right = k;
+    } else {
+      l->right = joinRight(l->right, k, r);
+    }
+    return balance(l);  // Высота выросла не больше чем на 1, как при вставке
+  }
+  // r выше l: спускаемся по левой ветке r
+  Node *joinLeft(Node *l, Node *k, Node *r) {
+    if (heightOf(r->left) <= heightOf(l) + 1) {
+      k->left = l;
+      k->right = r->left;
+      k->reCalc();
+      r->left = k;
+    } else {
+      r->left = joinLeft(l, k, r->left);
+    }
+    return balance(r);
+  }
+  // Разделение поддерева n по ключу: l - значения < key, r - значения > key,
+  // found - узел со значением key (отсоединённый) или nullptr
+  void splitNodes(Node *n, const T &key, Node *&l, Node *&found, Node *&r) {
+    if (n == nullptr) {
+      l = found = r = nullptr;
+      return;
+    }
+    Node *nl = n->left, *nr = n->right;
+    if (key < n->value) {
+      Node *rl;
+      splitNodes(nl, key, l, found, rl);
+      r = joinNodes(rl, n, nr);
+    } else if (n->value < key) {
+      Node *lr;
+      splitNodes(nr, key, lr, found, r);
+      l = joinNodes(nl, n, lr);
+    } else {
+      l = nl;
+      r = nr;
+      found = n;
+      n->left = n->right = nullptr;
+      n->reCalc();
+    }
+  }
+  // Отделить максимальный узел: last - он сам, результат - остальное поддерево
+  Node *splitLast(Node *n, Node *&last) {
+    if (n->right == nullptr) {
+      last = n;
+      return n->left;
+    }
+    Node *rest = splitLast(n->right, last);
+    return joinNodes(n->left, n, rest);
+  }
+  // Соединение без разделяющего узла: все значения l < всех значений r
+  Node *join2(Node *l, Node *r) {
+    if (l == nullptr) return r;
+    Node *last;
+    Node *rest = splitLast(l, last);
+    return joinNodes(rest, last, r);
+  }
+  // Забрать узлы поддерева n в список удаляемых
+  static void collect(Node *n, vector<Node *> &dropped) {
+    if (n == nullptr) return;
+    dropped.push_back(n);
+    collect(n->left, dropped);
+    collect(n->right, dropped);
+  }
+  // Поддеревья от этой высоты обрабатываются параллельно
+  static constexpr int PARALLEL_HEIGHT = 12;
+  template <class F1, class F2>
+  static void fork(bool parallel, ThreadPool &threads, F1 &&f1, F2 &&f2) {
+    if (parallel) {
+      threads.invoke(f1, f2);
+    } else {
+      f1();
+      f2();
+    }
+  }
+  // Операции над множествами для поддеревьев a и b (значения различны)
+  // Узлы, не попавшие в результат, собираются в dropped: пул нельзя трогать из разных потоков
+  Node *unionNodes(Node *a, Node *b, vector<Node *> &dropped, ThreadPool &threads) {
+    if (a == nullptr) return b;
+    if (b == nullptr) return a;
+    Node *l, *found, *r;
+    splitNodes(b, a->value, l, found, r);
+    if (found) dropped.push_back(found);  // Общий элемент берём из a
+    Node *al = a->left, *ar = a->right, *left, *right;
+    vector<Node *> droppedRight;
+    fork(
+      a->height >= PARALLEL_HEIGHT, threads, [&] { left = unionNodes(al, l, dropped, threads); },
+      [&] { right = unionNodes(ar, r, droppedRight, threads); });
+    dropped.insert(dropped.end(), droppedRight.begin(), droppedRight.end());
+    return joinNodes(left, a, right);
+  }
+  Node *intersectionNodes(Node *a, Node *b, vector<Node *> &dropped, ThreadPool &threads) {
+    if (a == nullptr || b == nullptr) {
+      collect(a, dropped);
+      collect(b, dropped);
+      return nullptr;
+    }
+    Node *l, *found, *r;
+    splitNodes(b, a->value, l, found, r);
+    Node *al = a->left, *ar = a->right, *left, *right;
+    vector<Node *> droppedRight;
+    fork(
+      a->height >= PARALLEL_HEIGHT, threads, [&] { left = intersectionNodes(al, l, dropped, threads); },
+      [&] { right = intersectionNodes(ar, r, droppedRight, threads); });
+    dropped.insert(dropped.end(), droppedRight.begin(), droppedRight.end());
+    if (found) {
+      dropped.push_back(found);
+      return joinNodes(left, a, right);
+    }
+    dropped.push_back(a);
+    return join2(left, right);
+  }
+  // a - b: разделяем a по корню b
+  Node *differenceNodes(Node *a, Node *b, vector<Node *> &dropped, ThreadPool &threads) {
+    if (a == nullptr || b == nullptr) {
+      collect(b, dropped);
+      return a;
+    }
+    Node *l, *found, *r;
+    splitNodes(a, b->value, l, found, r);
+    if (found) dropped.push_back(found);
+    dropped.push_back(b);
+    Node *bl = b->left, *br = b->right, *left, *right;
+    vector<Node *> droppedRight;
+    fork(
+      b->height >= PARALLEL_HEIGHT, threads, [&] { left = differenceNodes(l, bl, dropped, threads); },
+      [&] { right = differenceNodes(r, br, droppedRight, threads); });
+    dropped.insert(dropped.end(), droppedRight.begin(), droppedRight.end());
+    return join2(left, right);
+  }
+  // == Параллельные обходы для map, where, reduce ==
+  // Результаты f для значений поддерева n по возрастанию записываются в out[0..размер поддерева)
+  template <class U, class F>
+  void mapInto(Node *n, U *out, F &f, ThreadPool &threads) const {
+    if (n == nullptr) return;
+    if (n->height < PARALLEL_HEIGHT) {
+      for (Iterator it(n), end(n, true); it != end; ++it) *out++ = f(*it);
+      return;
+    }
+    int leftCount = subTreeSize(n->left);
+    threads.invoke([&] { mapInto(n->left, out, f, threads); },
+                   [&] {
+                     out[leftCount] = f(n->value);
+                     mapInto(n->right, out + leftCount + 1, f, threads);
+                   });
+  }
+  // Отобранные h значения поддерева n: по куску на каждое небольшое поддерево, куски идут по возрастанию
+  template <class H>
+  void whereInto(Node *n, vector<vector<T>> &chunks, H &h, ThreadPool &threads) const {
+    if (n == nullptr) return;
+    if (n->height < PARALLEL_HEIGHT) {
+      chunks.emplace_back();
+      for (Iterator it(n), end(n, true); it != end; ++it)
+        if (h(*it)) chunks.back().push_back(*it);
+      return;
+    }
+    vector<vector<T>> rightChunks;
+    threads.invoke(
+      [&] {
+        whereInto(n->left, chunks, h, threads);
+        if (h(n->value)) chunks.push_back({n->value});
+      },
+      [&] { whereInto(n->right, rightChunks, h, threads); });
+    for (auto &c : rightChunks) chunks.push_back(std::move(c));
+  }
+  // Свёртка непустого поддерева n в порядке возрастания (f ассоциативна)
+  template <class F>
+  T reduceInto(Node *n, F &f, ThreadPool &threads) const {
+    if (n->height < PARALLEL_HEIGHT) {
+      Iterator it(n), end(n, true);
+      T value = *it;
+      for (++it; it != end; ++it) value = f(value, *it);
+      return value;
+    }
+    T left, right;
+    threads.invoke([&] { if (n->left) left = reduceInto(n->left, f, threads); },
+                   [&] { if (n->right) right = reduceInto(n->right, f, threads); });
+    T value = n->left ? f(left, n->value) : n->value;
+    return n->right ? f(value, right) : value;
+  }
+  // Копируем оба дерева в пул результата и выполняем операцию над копиями
+  template <class Op>
+  static BinaryTree setOperation(const BinaryTree &a, const BinaryTree &b, ThreadPool &threads, Op op) {
+    BinaryTree res;
+    Node *x = res.copy(a.root);
+    Node *y = res.copy(b.root);
+    vector<Node *> dropped;
+    res.root = (res.*op)(x, y, dropped, threads);
+    res.size = a.size + b.size - (int)dropped.size();
+    for (Node *n : dropped) res.pool->destroy(n);
+    return res;
+  }
+  // Узлы other переходят в пул этого дерева; возвращает корень перенесённых узлов
+  Node *adopt(BinaryTree &other) {
+    Node *r = other.root;
+    if (r == nullptr || other.pool == pool) {
+      other.root = nullptr;
+      other.size = 0;
+      other.first = other.last = nullptr;
+      other.structureChanged();
+      return r;
+    }
+    if (other.pool.use_count() == 1 && other.pool->pooled() == nodes().pooled()) {
+      if (pool->pooled()) pool->adopt(*other.pool);  // Узлы из кучи (new/delete) переносить не нужно
+      other.root = nullptr;
+      other.size = 0;
+      other.first = other.last = nullptr;
+      other.structureChanged();
+      return r;
+    }
+    // Пул other используется и другими деревьями => копируем узлы
+    Node *c = copy(r);
+    other.clear();
+    return c;
   }
 
  public:
   BinaryTree() = default;
+  // Дерево с заданным способом выделения памяти под узлы
+  explicit BinaryTree(NodeAllocation allocation) : pool(std::make_shared<NodePool<Node>>(allocation)) {}
+  // Перемещение за O(1): узлы вместе с пулом переходят к новому владельцу
+  BinaryTree(BinaryTree &&other) noexcept
+      : root(other.root),
+        size(other.size),
+        pool(std::move(other.pool)),
+        shapes(std::move(other.shapes)),
+        first(other.first),
+        last(other.last),
+        linked(other.linked) {
+    other.root = nullptr;
+    other.size = 0;
+    other.first = other.last = nullptr;
+  }
+  // Глубокая копия за O(n) без рекурсии, в собственном пуле с тем же способом выделения памяти
+  // Прошивка не копируется, связи по возрастанию (keepLinks) строятся заново
+  BinaryTree(const BinaryTree &other)
+      : pool(std::make_shared<NodePool<Node>>(other.pool && !other.pool->pooled() ? NodeAllocation::Heap
+                                                                                   : NodeAllocation::Pool)) {
+    root = copy(other.root);
+    size = other.size;
+    if (other.linked) keepLinks();
+  }
+  BinaryTree &operator=(BinaryTree &&other) noexcept {
+    BinaryTree moved(std::move(other));  // Прежние узлы удаляются вместе с moved
+    swap(moved);
+    return *this;
+  }
+  BinaryTree &operator=(const BinaryTree &other) {
+    if (this != &other) {
+      BinaryTree copied(other);
+      swap(copied);
+    }
+    return *this;
+  }
+  void swap(BinaryTree &other) noexcept {
+    std::swap(root, other.root);
+    std::swap(size, other.size);
+    std::swap(pool, other.pool);
+    std::swap(shapes, other.shapes);
+    std::swap(first, other.first);
+    std::swap(last, other.last);
+    std::swap(linked, other.linked);
+  }
   BinaryTree(const T *items, const int size) {
-    for (int i = 0; i < size; i++) insert(items[i]);
+    buildFromUnsorted(items, items + size);
   }
   explicit BinaryTree(const std::set<T> &set) {
-    for (T x : set) insert(x);
+    buildFromSorted(set.begin(), (int)set.size());
   }
   BinaryTree(initializer_list<T> list) {
-    for (T x : list) insert(x);
+    buildFromUnsorted(list.begin(), list.end());
   }
   ~BinaryTree() {
-    delTree(root);
+    clear();
+  }
+  // Заменить содержимое дерева count значениями, упорядоченными по неубыванию, за O(count)
+  template <class It>
+  void buildFromSorted(It first, int count) {
+    clear();
+    root = build(first, count);
+    size = count;
+    if (linked) relink();
+  }
+  // То же для произвольного порядка: сначала сортируем (если ещё не отсортировано)
+  template <class It>
+  void buildFromUnsorted(It first, It last) {
+    if (std::is_sorted(first, last)) {
+      buildFromSorted(first, (int)std::distance(first, last));
+      return;
+    }
+    vector<T> sorted(first, last);
+    std::sort(sorted.begin(), sorted.end());
+    buildFromSorted(sorted.begin(), (int)sorted.size());
+  }
+  // Разделение дерева по ключу: в left - значения < key, в right - значения > key
+  // Узлы переходят в left и right (они делят пул этого дерева), само дерево становится пустым
+  // Возвращает, был ли key в дереве
+  bool split(const T &key, BinaryTree &left, BinaryTree &right) {
+    assert(&left != this && &right != this && &left != &right);
+    Node *l, *found, *r;
+    splitNodes(root, key, l, found, r);
+    int total = size;
+    root = nullptr;
+    size = 0;
+    structureChanged();
+    left.clear();
+    right.clear();
+    left.pool = right.pool = pool;
+    left.root = l;
+    right.root = r;
+    if (found) pool->destroy(found);
+    left.size = subTreeSize(l);
+    right.size = total - left.size - (found ? 1 : 0);
+    left.linked = right.linked = linked;
+    if (linked) {  // Связи внутри частей не меняются, обрезаются только края - O(log n)
+      left.relinkEnds();
+      right.relinkEnds();
+      first = last = nullptr;
+    }
+    return found != nullptr;
+  }
+  // Соединение деревьев: все значения left < key < все значения right
+  static BinaryTree join(BinaryTree &&left, const T &key, BinaryTree &&right) {
+    BinaryTree res(std::move(left));
+    int total = res.size + right.size + 1;
+    Node *rightRoot = right.root, *rightFirst = right.first, *rightLast = right.last;
+    bool rightLinked = right.linked;
+    Node *r = res.adopt(right);
+    Node *k = res.nodes().create(key);
+    res.root = res.joinNodes(res.root, k, r);
+    res.size = total;
+    res.structureChanged();  // Индекс поддеревьев пришёл из left вместе с узлами, а хеши изменились
+    if (res.linked) {
+      if (rightLinked && r == rightRoot) {  // Узлы right не копировались: сшиваем списки через k за O(1)
+        res.linkBetween(k, res.last, rightFirst);
+        if (rightFirst) res.last = rightLast;
+      } else {
+        res.relink();
+      }
+    }
+    return res;
+  }
+  // Объединение, пересечение и разность деревьев как множеств (значения в каждом дереве различны)
+  // Исходные деревья не меняются, поэтому сначала оба копируются - O(n + m) последовательно.
+  // Затем рекурсия на split/join по копиям: O(m log(n/m + 1)) работы и O(log² n) глубины,
+  // большие поддеревья обрабатываются параллельно на пуле потоков. Итого O(n + m): для множеств
+  // очень разного размера выгоднее поиск элементов меньшего в большем (см. Set)
+  static BinaryTree setUnion(const BinaryTree &a, const BinaryTree &b,
+                                ThreadPool &threads = ThreadPool::instance()) {
+    return setOperation(a, b, threads, &BinaryTree::unionNodes);
+  }
+  static BinaryTree intersection(const BinaryTree &a, const BinaryTree &b,
+                                    ThreadPool &threads = ThreadPool::instance()) {
+    return setOperation(a, b, threads, &BinaryTree::intersectionNodes);
+  }
+  static BinaryTree difference(const BinaryTree &a, const BinaryTree &b,
+                                  ThreadPool &threads = ThreadPool::instance()) {
+    return setOperation(a, b, threads, &BinaryTree::differenceNodes);
   }
   int getSize() const {
     return size;
@@ -191,14 +767,74 @@ struct BinaryTree {
   Node *getRoot() {
     return root;
   }
+  // Неизменяемый снимок для быстрого поиска (раскладка Эйтцингера), строится за O(n)
+  FrozenTree<T> freeze() const {
+    return FrozenTree<T>(begin(), size);
+  }
+  // Персистентная копия: снимки и поддеревья за O(1), изменения не трогают прежние версии. O(n)
+  PersistentTree<T> persistent() const {
+    return PersistentTree<T>(begin(), size);
+  }
+  // Запись в двоичном формате (см. serialization.h): заголовок и ключи по возрастанию, O(n)
+  void save(std::ostream &out, uint8_t flags = 0) const {
+    BinaryWriter<T> writer(out, size, flags);
+    for (const T &x : *this) writer.write(x);
+    writer.finish();
+  }
+  // Чтение из двоичного формата: ключи уже отсортированы, дерево строится сразу сбалансированным за O(n)
+  // distinct - ключи должны строго возрастать. При ошибке формата - FormatError, дерево не меняется
+  void load(std::istream &in, bool distinct = false) {
+    BinaryReader<T> reader(in, distinct);
+    if (reader.size() > (uint64_t)std::numeric_limits<int>::max())
+      throw FormatError("Двоичный формат: слишком много ключей для дерева");
+    BinaryTree loaded;  // Узлы в пуле: при ошибке посреди чтения память вернётся вместе с пулом
+    auto it = reader.begin();
+    loaded.root = loaded.build(it, (int)reader.size());
+    loaded.size = (int)reader.size();
+    reader.finish();
+    if (linked) loaded.keepLinks();
+    swap(loaded);
+  }
+  // Запись образа для отображения в память (см. mappedtree.h): узлы с относительными смещениями,
+  // читается через MappedTree<T> без разбора и без выделения памяти. O(n)
+  void saveImage(std::ostream &out, uint8_t flags = 0) const {
+    MappedTreeWriter<T>(out).write(root, flags);
+  }
   // Базовые операции: вставка, поиск, удаление
   // Вставка: добавить значение в двоичное дерево поиска
   void insert(const T &value) {
-    size++;  // Увеличиваем размер дерева
+    attach(nodes().create(value));
+  }
+  // Значение перемещается в узел без копирования
+  void insert(T &&value) {
+    attach(nodes().create(std::move(value)));
+  }
+  // Значение создаётся прямо в узле из параметров конструктора T
+  template <class... Args>
+  void emplace(Args &&...args) {
+    attach(nodes().create(std::in_place, std::forward<Args>(args)...));
+  }
+  // Вставка, если такого значения ещё нет - за один спуск от корня
+  // Возвращает узел с этим значением и признак того, что узел только что добавлен
+  std::pair<Node *, bool> insertUnique(const T &value) {
+    return insertUniqueValue(value);
+  }
+  std::pair<Node *, bool> insertUnique(T &&value) {
+    return insertUniqueValue(std::move(value));
+  }
+  // Рекурсивная вставка (прежняя реализация, для сравнения скорости); связи по возрастанию не ведёт,
+  // поэтому в режиме связей вставка идёт обычным путём
+  void insertRecursive(const T &value) {
+    if (linked) {
+      insert(value);
+      return;
+    }
+    structureChanged();
+    size++;
     if (root) {
       root = insertTo(root, value);
     } else
-      root = new Node(value);
+      root = nodes().create(value);
   }
   // Поиск узла по значению
   Node *find(const T &v) const {
@@ -213,12 +849,15 @@ struct BinaryTree {
     }
     return nullptr;  // Не нашли узла со значением v
   }
+ private:
   // Удаление узла по значению
   // Входные параметры: дерево и значение которое нужно удалить
   // Возвращаем дерево с удалённым узлом (если есть)
+  // Связи по возрастанию (keepLinks) не ведёт, поэтому закрыто: снаружи - removeRecursive
   Node *remove(Node *r, const T &v) {
     // Пустое дерево - искать и удалять негде
     if (r == nullptr) return nullptr;
+    structureChanged();
     // Если значение не равно, то есть мы ещё не нашли, идём по поддеревьям
     if (v < r->value) {  // Если значение меньше, то удаляем в левом поддереве
       r->left = remove(r->left, v);
@@ -243,12 +882,51 @@ struct BinaryTree {
       } else
         r = nullptr;
       size--;
-      delete toDelete;
+      nodes().destroy(toDelete);
     }
     return balance(r);
   }
+ public:
   // Удаление узла по значению
+  // Спускаемся без рекурсии, запоминая путь, затем поднимаемся и балансируем
   void remove(const T &v) {
+    Node *path[MAX_HEIGHT];
+    int depth = 0;
+    Node *n = root;
+    while (n != nullptr) {
+      if (v < n->value) {
+        path[depth++] = n;
+        n = n->left;
+      } else if (n->value < v) {
+        path[depth++] = n;
+        n = n->right;
+      } else
+        break;
+    }
+    if (n == nullptr) return;     // Значения нет в дереве
+    if (n->left && n->right) {  // Есть оба поддерева: заменяем значение на минимум из правого поддерева
+      path[depth++] = n;
+      Node *m = n->right;
+      while (m->left) {
+        path[depth++] = m;
+        m = m->left;
+      }
+      n->value = m->value;
+      n = m;  // Удаляем узел минимума: у него нет левого поддерева
+    }
+    if (linked) unlink(n);  // Значение следующего узла m перешло в предыдущий => из списка уходит m
+    structureChanged();
+    replaceChild(path, depth, n, n->left ? n->left : n->right);
+    size--;
+    nodes().destroy(n);
+    fixPath(path, depth);
+  }
+  // Рекурсивное удаление (прежняя реализация, для сравнения скорости); в режиме связей - обычное удаление
+  void removeRecursive(const T &v) {
+    if (linked) {
+      remove(v);
+      return;
+    }
     root = remove(root, v);
   }
   // Высота дерева
@@ -285,167 +963,450 @@ struct BinaryTree {
     return maximum(n)->value;
   }
   // Поддерево по ключу
-  BinaryTree<T> *subTree(const T &v) {
-    return new BinaryTree<T>(copy(find(v)));
+  BinaryTree *subTree(const T &v) {
+    auto *res = new BinaryTree();
+    res->root = res->copy(find(v));  // Узлы копии выделяются в пуле нового дерева
+    res->size = subTreeSize(res->root);
+    return res;
   }
-  // Вычислить размер поддерева
-  int subTreeSize(const Node *n) {
-    if (n)
-      return subTreeSize(n->left) + 1 + subTreeSize(n->right);
-    else
-      return 0;
+  // Размер поддерева - хранится в узле
+  static int subTreeSize(const Node *n) {
+    return n ? n->count : 0;
+  }
+  // Пересчитать количество узлов поддерева обходом (для проверки)
+  int countNodes(const Node *n) {
+    int res = 0;
+    for (Iterator it(const_cast<Node *>(n)), end(const_cast<Node *>(n), true); it != end; ++it) res++;
+    return res;
   }
   // Посчитать размер дерева
   int calcSize() {
-    return subTreeSize(root);
+    return countNodes(root);
+  }
+  // == Порядковые статистики за O(log n) ==
+  // k-й по возрастанию узел (k от 0)
+  Node *select(int k) const {
+    if (k < 0 || k >= subTreeSize(root)) throw IndexOutOfRange("select: k = " + to_string(k));
+    Node *n = root;
+    while (true) {
+      int leftCount = subTreeSize(n->left);
+      if (k == leftCount) return n;
+      if (k < leftCount) {
+        n = n->left;
+      } else {
+        k -= leftCount + 1;
+        n = n->right;
+      }
+    }
+  }
+  // Количество значений < v
+  int countLess(const T &v) const {
+    int res = 0;
+    for (Node *n = root; n != nullptr;) {
+      if (n->value < v) {  // n и всё его левое поддерево меньше v
+        res += subTreeSize(n->left) + 1;
+        n = n->right;
+      } else {
+        n = n->left;
+      }
+    }
+    return res;
+  }
+  // Позиция значения v по возрастанию (от 0), -1 если значения нет в дереве
+  int rank(const T &v) const {
+    int res = countLess(v);
+    if (res < size && select(res)->value == v) return res;
+    return -1;
   }
   // Сравнение деревьев
-  bool matchTree(const Node *a, const Node *b) {
-    if (a == nullptr && b == nullptr) return true;
-    if (a == nullptr || b == nullptr) return false;
-    if (a->value != b->value) return false;
-    return matchTree(a->left, b->left) && matchTree(a->right, b->right);
+  // Разные поддеревья почти всегда отличаются структурным хешем или размером - это O(1).
+  // Совпадение хешей проверяем точно: сравниваем пары узлов по левым веткам, пары правых поддеревьев
+  // откладываем в стек
+  bool matchTree(const Node *a, const Node *b) const {
+    if (hashOf(a) != hashOf(b) || subTreeSize(a) != subTreeSize(b)) return false;
+    const Node *stack[MAX_HEIGHT][2];
+    int top = 0;
+    while (true) {
+      for (; a != nullptr || b != nullptr; a = a->left, b = b->left) {
+        if (a == nullptr || b == nullptr) return false;
+        if (a->hash != b->hash || a->value != b->value) return false;
+        if (a->right || b->right) {
+          if (top == MAX_HEIGHT) return false;  // Слишком высокое дерево => форма отличается
+          stack[top][0] = a->right;
+          stack[top][1] = b->right;
+          top++;
+        }
+      }
+      if (top == 0) return true;
+      top--;
+      a = stack[top][0];
+      b = stack[top][1];
+    }
   }
-  bool match(BinaryTree<T> &tree) {
+  bool match(BinaryTree &tree) {
     return matchTree(root, tree.root);
   }
-  bool subTreeCheck(BinaryTree<T> *subTree) {
+  // Структурный хеш всего дерева: равные по форме и значениям деревья имеют равные хеши
+  // (например, для поиска одинаковых деревьев среди многих)
+  uint64_t structureHash() const {
+    return hashOf(root);
+  }
+  // Есть ли поддерево той же формы с теми же значениями, что и subTree, в любом месте дерева
+  bool subTreeCheck(BinaryTree *subTree) {
     if (subTree == nullptr || subTree->root == nullptr) return false;
-    Node *n = find(subTree->root->value);
-    if (!n) return false;
-    return matchTree(subTree->root, n);
+    return containsSubtree(subTree->root);
   }
-  struct Print : public Operation {
-    stringstream ss;
-    void apply(Node *n) override {
-      ss << n->value << " ";
+  // То же для поддерева n любого дерева. Кандидаты ищутся по хешу в индексе поддеревьев - ожидаемо O(1),
+  // совпавший по хешу кандидат проверяется точно за O(размер n). Индекс строится за O(size)
+  // при первом поиске после изменения дерева
+  bool containsSubtree(const Node *n) {
+    if (n == nullptr) return false;
+    if (!shapes) {
+      shapes = std::make_unique<ShapeIndex>();
+      shapes->reserve(size);
+      traverse<Order::NLR>([&](const Node *x) { shapes->emplace(x->hash, x); });
     }
-    string result() {
-      return trim_copy(ss.str());
+    auto range = shapes->equal_range(n->hash);
+    for (auto it = range.first; it != range.second; ++it)
+      if (matchTree(it->second, n)) return true;
+    return false;
+  }
+  // Обход в порядке order без рекурсии и без выделения памяти (см. traversal.h)
+  // visit(Node *) встраивается; если он возвращает bool, false останавливает обход. Результат - пройдено ли всё
+  template <Order order, class Visit>
+  bool traverse(Visit visit) const {
+    return ::traverse<order, MAX_HEIGHT>(root, visit);
+  }
+  // Симметричный обход (LNR или RNL) Морриса: без стека, но дерево на время обхода меняется
+  template <Order order, class Visit>
+  bool traverseMorris(Visit visit) {
+    return ::traverseMorris<order>(root, visit);
+  }
+  // Вызов f(std::integral_constant<Order, order>()) для порядка, известного только во время выполнения
+  template <class F>
+  static void withOrder(Order order, F f) {
+    switch (order) {
+    case Order::NLR:
+      return f(std::integral_constant<Order, Order::NLR>());
+    case Order::NRL:
+      return f(std::integral_constant<Order, Order::NRL>());
+    case Order::LRN:
+      return f(std::integral_constant<Order, Order::LRN>());
+    case Order::LNR:
+      return f(std::integral_constant<Order, Order::LNR>());
+    case Order::RLN:
+      return f(std::integral_constant<Order, Order::RLN>());
+    case Order::RNL:
+      return f(std::integral_constant<Order, Order::RNL>());
     }
-  };
+  }
+  // Значения через пробел в порядке обхода order
+  template <Order order>
+  string printOrder() const {
+    TextWriter out;
+    traverse<order>([&](const Node *n) {
+      out.value(n->value);
+      out.put(' ');  // Последний пробел не попадёт в результат
+    });
+    return out.take();
+  }
   // == Обходы ==
   // 1. КЛП = Корень Левый Правый
   string toNLR() {
-    Print op;
-    if (root) root->NLR(op);
-    return op.result();
+    return printOrder<Order::NLR>();
   }
   // 2. КПЛ = Корень Правый Левый
   string toNRL() {
-    Print op;
-    if (root) root->NRL(op);
-    return op.result();
+    return printOrder<Order::NRL>();
   }
   // 3. ЛПК = Левый Правый Корень
   string toLRN() {
-    Print op;
-    if (root) root->LRN(op);
-    return op.result();
+    return printOrder<Order::LRN>();
   }
   // 4. ЛКП = Левый Корень Правый
   string toLNR() {
-    Print op;
-    if (root) root->LNR(op);
-    return op.result();
+    return printOrder<Order::LNR>();
   }
   // 5. ПЛК = Правый Левый Корень
   string toRLN() {
-    Print op;
-    if (root) root->RLN(op);
-    return op.result();
+    return printOrder<Order::RLN>();
   }
   // 6. ПКЛ = Правый Корень Левый
   string toRNL() {
-    Print op;
-    if (root) root->RNL(op);
-    return op.result();
+    return printOrder<Order::RNL>();
+  }
+  // Вывод по скомпилированному формату (см. formatprogram.h): N - значение, L и R - поддеревья,
+  // остальные символы - как есть; лист выводится одним значением
+  void print(const FormatProgram &format, TextWriter &out) const {
+    format.run(
+      root, [&](const Node *n) { out.value(n->value); }, [&](const char *s, size_t len) { out.put(s, len); }, true);
   }
-  // Вывод строку в соответствии с форматом
+  // Вывод строку в соответствии с форматом; для многих деревьев с одним форматом - см. FormatProgram
   string toString(const char *format) {
-    stringstream ss;
-    if (root) root->print(format, ss);
-    return trim_copy(ss.str());
+    return toString(FormatProgram(format));
+  }
+  string toString(const FormatProgram &format) const {
+    TextWriter out;
+    print(format, out);
+    return out.take();
+  }
+  // То же сразу в поток, без промежуточной строки
+  void printTo(std::ostream &os, const char *format) {
+    printTo(os, FormatProgram(format));
+  }
+  void printTo(std::ostream &os, const FormatProgram &format) const {
+    TextWriter out(os);
+    print(format, out);
   }
   // map, reduce, where
+  // Функции можно передавать любые вызываемые объекты (в т.ч. лямбды с состоянием) - они встраиваются
   // map - применение функции к каждому элементу дерево
   // Создаётся новое дерево
-  BinaryTree<T> map(T f(T)) {
-    BinaryTree<T> res;
-    for (T x : *this) {
-      res.insert(f(x));
-    }
+  BinaryTree map(T f(T)) const {
+    return mapTo<T, Monoid>(f);
+  }
+  // Результат f может иметь другой тип: получаем BinaryTree<U>
+  template <class F, class U = std::decay_t<std::invoke_result_t<F &, const T &>>>
+  BinaryTree<U> map(F f) const {
+    return mapTo<U, NoAggregate<U>>(f);
+  }
+  // map для строго возрастающей f (x < y => f(x) < f(y)), тот же контракт, что у Set::mapMonotone:
+  // форма дерева сохраняется, поэтому она копируется за O(n) без сортировки и вставок.
+  // Равные значения дерева переходят в равные. В отладочной сборке (DEBUG_BUILD) контракт проверяется
+  template <class F, class U = std::decay_t<std::invoke_result_t<F &, const T &>>>
+  BinaryTree<U> mapMonotone(F f) const {
+    BinaryTree<U> res;
+    res.root = res.copyMapped(root, f);
+    res.size = size;
     return res;
   }
   // where фильтрует значения из списка l с помощью функции-фильтра h
-  BinaryTree<T> where(bool h(T)) {
-    BinaryTree<T> res;
-    for (T x : *this) {
-      if (h(x)) res.insert(x);
+  // Отобранные значения уже упорядочены => дерево строится за O(n)
+  BinaryTree where(bool h(T)) const {
+    return where<bool (*)(T)>(h);
+  }
+  template <class H>
+  BinaryTree where(H h) const {
+    vector<T> values;
+    for (const T &x : *this) {
+      if (h(x)) values.push_back(x);
     }
+    BinaryTree res;
+    res.buildFromSorted(values.begin(), (int)values.size());
     return res;
   }
   // reduce - применяем к каждой паре значений пока не получим одно значение
-  T reduce(T f(T, T)) {
+  T reduce(T f(T, T)) const {
+    return reduce(root, f);
+  }
+  template <class F>
+  T reduce(F f) const {
     return reduce(root, f);
   }
-  T reduce(Node *n, T f(T, T)) {
-    if (n->left) {                                // Если есть левое поддерево
-      T value = f(n->value, reduce(n->left, f));  // Считаем значение для левого поддерева
-      if (n->right) {                             // Если есть правое поддерево
-        return f(value, reduce(n->right, f));     // Результат
+  // == Параллельные map, where, reduce на пуле потоков ==
+  // Значения f(x) по возрастанию: каждое поддерево пишет в свою часть массива (размеры поддеревьев
+  // известны), затем одна параллельная сортировка
+  template <class F>
+  vector<T> mapSorted(F f, ThreadPool &threads = ThreadPool::instance()) const {
+    vector<T> res(size);
+    mapInto(root, res.data(), f, threads);
+    parallelSort(res.begin(), res.end(), threads);
+    return res;
+  }
+  // Отобранные значения по возрастанию: поддеревья фильтруются параллельно в свои буферы
+  template <class H>
+  vector<T> whereSorted(H h, ThreadPool &threads = ThreadPool::instance()) const {
+    vector<vector<T>> chunks;
+    whereInto(root, chunks, h, threads);
+    vector<T> res;
+    size_t total = 0;
+    for (auto &c : chunks) total += c.size();
+    res.reserve(total);
+    for (auto &c : chunks) res.insert(res.end(), c.begin(), c.end());
+    return res;
+  }
+  template <class F>
+  BinaryTree parallelMap(F f, ThreadPool &threads = ThreadPool::instance()) const {
+    vector<T> values = mapSorted(f, threads);
+    BinaryTree res;
+    res.buildFromSorted(values.begin(), (int)values.size());
+    return res;
+  }
+  template <class H>
+  BinaryTree parallelWhere(H h, ThreadPool &threads = ThreadPool::instance()) const {
+    vector<T> values = whereSorted(h, threads);
+    BinaryTree res;
+    res.buildFromSorted(values.begin(), (int)values.size());
+    return res;
+  }
+  // Поддеревья сворачиваются параллельно, порядок значений сохраняется => f должна быть ассоциативна
+  template <class F>
+  T parallelReduce(F f, ThreadPool &threads = ThreadPool::instance()) const {
+    if (root == nullptr) throw range_error("Empty tree");
+    return reduceInto(root, f, threads);
+  }
+  // Агрегат всего дерева - хранится в корне, O(1)
+  Aggregate reduce() const {
+    return aggregateOf(root);
+  }
+  // Агрегат значений из отрезка [lo, hi] - O(log n)
+  Aggregate reduceRange(const T &lo, const T &hi) const {
+    // Спускаемся до узла, где отрезок расходится в левое и правое поддеревья
+    Node *n = root;
+    while (n && (n->value < lo || hi < n->value)) n = (n->value < lo) ? n->right : n->left;
+    if (n == nullptr) return Monoid::identity();
+    Aggregate left = Monoid::identity();  // Значения >= lo из левого поддерева
+    for (Node *x = n->left; x != nullptr;) {
+      if (x->value < lo) {
+        x = x->right;
+      } else {  // x и его правое поддерево целиком в отрезке, они правее найденного ранее
+        left = Monoid::combine(Monoid::combine(Monoid::lift(x->value), aggregateOf(x->right)), left);
+        x = x->left;
       }
-      return value;
     }
-    if (n->right) {                             // Если есть правое поддерево
-      return f(n->value, reduce(n->right, f));  // Результат
+    Aggregate right = Monoid::identity();  // Значения <= hi из правого поддерева
+    for (Node *x = n->right; x != nullptr;) {
+      if (hi < x->value) {
+        x = x->left;
+      } else {
+        right = Monoid::combine(right, Monoid::combine(aggregateOf(x->left), Monoid::lift(x->value)));
+        x = x->right;
+      }
     }
-    return n->value;  // Нет поддеревьев => возвращаем значение из узла
+    return Monoid::combine(Monoid::combine(left, Monoid::lift(n->value)), right);
+  }
+  // Свёртка поддерева в порядке возрастания: f(f(f(x1, x2), x3), ...)
+  // Прежняя рекурсивная свёртка шла в порядке, зависящем от формы дерева (f(узел, левое), затем правое);
+  // теперь порядок тот же, что у parallelReduce и Set::reduce. Для некоммутативной f (например, сцепления
+  // строк) результат - значения по возрастанию
+  template <class F>
+  T reduce(Node *n, F f) const {
+    if (n == nullptr) throw range_error("Empty tree");
+    const Node *min = n;
+    while (min->left) min = min->left;
+    T value = min->value;  // Свёртка начинается с минимального значения
+    ::traverse<Order::LNR, MAX_HEIGHT>(n, [&](const Node *x) {
+      if (x != min) value = f(value, x->value);
+    });
+    return value;
   }
   // == Прошивка ==
   // - по фиксированному обходу
   // - по обходу, задаваемому параметром метода
   // Для прошивки - начальный узел
-  Node *first;
-  // Прошивка
-  struct Thread : public Operation {
-    Node *first = nullptr;          // Первый узел в обходе
-    Node *last = nullptr;           // Последний узел в обходе
-    void apply(Node *n) override {  // Добавить узел в прошивку
+  Node *first = nullptr;
+  // В режиме связей - последний узел (максимум)
+  Node *last = nullptr;
+
+ private:
+  bool linked = false;  // Режим связей по возрастанию (keepLinks)
+
+ public:
+  // Прошивка узлов в порядке обхода order: каждый узел ссылается на следующий (next)
+  // В режиме связей прошивка LNR уже готова; другой порядок перезаписывает next и выключает режим
+  template <Order order>
+  Node *threadInOrder() {
+    if (linked && order == Order::LNR) return first;
+    return threadBy([&](auto visit) { traverse<order>(visit); });
+  }
+  // Прошивка в порядке, в котором walk(visit) передаёт узлы посетителю
+  template <class Walk>
+  Node *threadBy(Walk walk) {
+    linked = false;
+    Node *previous = nullptr;
+    first = last = nullptr;
+    walk([&](Node *n) {
       if (first == nullptr) first = n;  // Если это первый узел в прошивке => запоминаем как первый
-      if (last != nullptr) last->next = n;  // Если был какой-то узел до этого => пришиваем к нему текущий
-      n->next = nullptr;  // Стираем ссылку на следующий у текущего элемента
-      // затираем старую прошивку
-      last = n;
-    };
-  };
-  // Прошивка с результатом в виде вектора
-  struct ThreadVector : public Operation {
-    vector<Node *> path;            // Путь по дереву
-    void apply(Node *n) override {  // Добавить узел в прошивку
-      path.push_back(n);
-    };
-  };
+      if (previous != nullptr) previous->next = n;  // Если был какой-то узел до этого => пришиваем к нему текущий
+      n->next = nullptr;  // Стираем старую прошивку у текущего элемента
+      previous = n;
+    });
+    return first;
+  }
+  // == Связи по возрастанию ==
+  // В режиме связей next и prev каждого узла - следующий и предыдущий узлы по возрастанию, first и last -
+  // минимум и максимум. Вставка и удаление обновляют их за O(1) (соседи нового узла известны после спуска),
+  // вращения порядок узлов не меняют. Поэтому соседи узла - O(1), а просмотр по возрастанию - проход
+  // по списку без стека. Цена - указатель prev в каждом узле
+  // Включение связывает узлы за O(n); выключение ничего не стоит
+  void keepLinks(bool on = true) {
+    linked = on;
+    if (on) relink();
+  }
+  bool linksKept() const {
+    return linked;
+  }
+  // Следующий и предыдущий по возрастанию узлы (nullptr на краю) - O(1), только в режиме связей
+  Node *successor(const Node *n) const {
+    assert(linked);
+    return n->next;
+  }
+  Node *predecessor(const Node *n) const {
+    assert(linked);
+    return n->prev;
+  }
+  // Первый узел со значением >= v, nullptr если таких нет - O(log n)
+  Node *lowerBound(const T &v) const {
+    Node *res = nullptr;
+    for (Node *n = root; n != nullptr;) {
+      if (n->value < v) {
+        n = n->right;
+      } else {
+        res = n;
+        n = n->left;
+      }
+    }
+    return res;
+  }
+  // f(value) для значений из отрезка [lo, hi] по возрастанию: начало ищется за O(log n),
+  // дальше в режиме связей - по next, иначе - итератором. Прошивать дерево перед просмотром не нужно
+  template <class F>
+  void forRange(const T &lo, const T &hi, F f) const {
+    if (linked) {
+      for (Node *n = lowerBound(lo); n != nullptr && !(hi < n->value); n = n->next) f(n->value);
+      return;
+    }
+    Iterator it = begin(), e = end();
+    it.seek(lo);
+    for (; it != e && !(hi < *it); ++it) f(*it);
+  }
   // Прошивка дерева в порядке Корень Левое Правое
   Node *thread() {
+    return threadInOrder<Order::NLR>();
+  }
+  // Связать все узлы по возрастанию заново - O(n)
+  Node *relink() {
+    Node *previous = nullptr;
     first = nullptr;
-    Thread td;
-    NLR(root, td);
-    first = td.first;
+    traverse<Order::LNR>([&](Node *n) {
+      if (previous) {
+        previous->next = n;
+      } else {
+        first = n;
+      }
+      n->prev = previous;
+      previous = n;
+    });
+    if (previous) previous->next = nullptr;
+    last = previous;
     return first;
   }
   vector<Node *> threadAsVector() {
-    ThreadVector td;
-    NLR(root, td);
-    return td.path;
+    vector<Node *> path;  // Путь по дереву
+    path.reserve(size);
+    traverse<Order::NLR>([&](Node *n) { path.push_back(n); });
+    return path;
   }
   // Прошивка дерева в заданном порядке N-Корень L-Левое R-Правое
+  // Строка из трёх разных букв - обход из traversal.h; любая другая (например "NLRN") выполняется,
+  // как раньше, по буквам: N - узел, L и R - поддеревья, остальные символы пропускаются
   Node *thread(const char *order) {
-    assert(strlen(order) == 3);
-    first = nullptr;
-    Thread td;
-    go(root, order, td);
-    first = td.first;
+    Order o = Order::NLR;
+    if (!parseOrder(order, o)) {
+      FormatProgram program(order, false);
+      return threadBy([&](auto visit) { program.run(root, visit); });
+    }
+    withOrder(o, [&](auto tag) { threadInOrder<decltype(tag)::value>(); });
     return first;
   }
   // Проверка разницы высот для данной вершины: высота_левого - высота_правого
@@ -457,6 +1418,8 @@ struct BinaryTree {
   void checkBeforeBalance(Node *n) {
     assert(n->height == height(n));         // Проверяем правильность высоты
     assert(n->dis == disbalance_check(n));  // Правильность дисбаланса
+    assert(n->count == countNodes(n));      // Правильность размера поддерева
+    assert(n->hash == StructureHash::combine(hashOf(n->left), StructureHash::ofValue(n->value), hashOf(n->right)));
     assert(n->dis <= 2);                    // Дисбаланс в корректных пределах
     assert(n->dis >= -2);
     if (n->left) {  // Проверяем те же свойства для левого
@@ -469,7 +1432,21 @@ struct BinaryTree {
     }
   }
   void check() {
-    check(root);
+    if (root) check(root);
+    if (linked) checkLinks();
+  }
+  // Проверка связей по возрастанию: список совпадает с обходом ЛКП
+  void checkLinks() {
+    Node *expected = first, *previous = nullptr;
+    traverse<Order::LNR>([&](Node *n) {
+      assert(n == expected);
+      assert(n->prev == previous);
+      previous = n;
+      expected = n->next;
+    });
+    assert(expected == nullptr);
+    assert(last == previous);
+    (void)expected;
   }
   void check(Node *n) {
     checkBeforeBalance(n);
@@ -712,27 +1689,33 @@ struct BinaryTree {
       wcout << L" " << wide << endl;
     }
   }
-  // Итератор для BinaryTree
+  // Итератор для BinaryTree: обход ЛКП (по возрастанию значений)
+  // Хранит путь от корня до текущего узла, поэтому ничего не выделяет в памяти
   struct Iterator {
-    using iterator_category = std::forward_iterator_tag;
+    using iterator_category = std::bidirectional_iterator_tag;
     using difference_type = std::ptrdiff_t;
     using value_type = T;
     using pointer = T *;
     using reference = T &;
 
-    // Создаём обход и запоминаем индекс
-    explicit Iterator(Node *node, int index) : index(index), root(node) {
-      NLR(node);
+    // Итератор на минимальный элемент (begin) или за последним элементом (end)
+    explicit Iterator(Node *node, bool atEnd = false) : root(node) {
+      if (!atEnd) pushLeft(node);
     }
     reference operator*() const {
-      return path[index]->value;
+      return path[depth - 1]->value;
     }
-    pointer operator->() {
-      return path[index]->value;
+    pointer operator->() const {
+      return &path[depth - 1]->value;
     }
     Iterator &operator++() {
-      index++;
-      if (index > path.size()) index = path.size();
+      Node *n = path[depth - 1];
+      if (n->right) {  // Следующий - самый левый в правом поддереве
+        pushLeft(n->right);
+      } else {  // Иначе поднимаемся, пока приходим справа
+        Node *child = path[--depth];
+        while (depth > 0 && path[depth - 1]->right == child) child = path[--depth];
+      }
       return *this;
     }
     Iterator operator++(int) {
@@ -740,29 +1723,82 @@ struct BinaryTree {
       ++(*this);
       return tmp;
     }
+    Iterator &operator--() {
+      if (depth == 0) {  // end() => последний элемент
+        pushRight(root);
+        return *this;
+      }
+      Node *n = path[depth - 1];
+      if (n->left) {  // Предыдущий - самый правый в левом поддереве
+        pushRight(n->left);
+      } else {  // Иначе поднимаемся, пока приходим слева
+        Node *child = path[--depth];
+        while (depth > 0 && path[depth - 1]->left == child) child = path[--depth];
+      }
+      return *this;
+    }
+    Iterator operator--(int) {
+      Iterator tmp = *this;
+      --(*this);
+      return tmp;
+    }
+    // Переход к первому элементу >= v (v не меньше текущего элемента)
+    // Поднимаемся до ближайшего предка, в левом поддереве которого находимся и который >= v,
+    // затем ищем в этом поддереве. Серия из m переходов по дереву из n элементов - O(m log(n/m))
+    void seek(const T &v) {
+      if (depth == 0) return;
+      while (depth > 1) {
+        Node *child = path[depth - 1];
+        Node *parent = path[depth - 2];
+        if (parent->left == child && !(parent->value < v)) break;  // Ответ - в child или сам parent
+        depth--;
+      }
+      Node *n = path[--depth];
+      int best = depth;  // Если в поддереве ничего не найдём: parent или end()
+      while (n != nullptr) {
+        path[depth++] = n;
+        if (n->value < v) {
+          n = n->right;
+        } else {
+          best = depth;
+          n = n->left;
+        }
+      }
+      depth = best;
+    }
     friend bool operator==(const Iterator &a, const Iterator &b) {
-      return a.index == b.index && a.root == b.root;
+      return a.current() == b.current() && a.root == b.root;
     };
     friend bool operator!=(const Iterator &a, const Iterator &b) {
-      return a.index != b.index || a.root != b.root;
+      return !(a == b);
     };
 
    private:
-    // Node Left Right - Корень Левое Правое
-    void NLR(Node *node) {
-      if (node == nullptr) return;
-      path.push_back(node);  // Добавляем узел в путь
-      if (node->left != nullptr) NLR(node->left);
-      if (node->right != nullptr) NLR(node->right);
-    }
-    std::vector<Node *> path;
-    int index;
+    Node *current() const {
+      return depth ? path[depth - 1] : nullptr;
+    }
+    // Спуск влево до минимума поддерева
+    void pushLeft(Node *n) {
+      for (; n != nullptr; n = n->left) {
+        assert(depth < MAX_HEIGHT);
+        path[depth++] = n;
+      }
+    }
+    // Спуск вправо до максимума поддерева
+    void pushRight(Node *n) {
+      for (; n != nullptr; n = n->right) {
+        assert(depth < MAX_HEIGHT);
+        path[depth++] = n;
+      }
+    }
+    Node *path[MAX_HEIGHT];  // Путь от корня до текущего узла
+    int depth = 0;           // Длина пути, 0 - итератор за последним элементом
     Node *root;
   };
   Iterator begin() const {
-    return Iterator(root, 0);
+    return Iterator(root);
   }
   Iterator end() const {
-    return Iterator(root, getSize());
+    return Iterator(root, true);
   }
 };
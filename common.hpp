@@ -31,6 +31,18 @@ class IndexOutOfRange : public std::exception {  // наследуем наш к
   }
 };
 
+// Ошибка в формате входных данных: неверный заголовок, обрезанный файл, несовпадение контрольной суммы
+class FormatError : public std::exception {
+  std::string message_;
+
+ public:
+  explicit FormatError(const std::string &message) : message_(message) {}
+  explicit FormatError(const char *message) : message_(message) {}
+  const char *what() const noexcept override {
+    return message_.c_str();
+  }
+};
+
 // trim from start (in place)
 static inline void ltrim(std::string &s) {
   s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
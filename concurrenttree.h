@@ -0,0 +1,442 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+#include "epoch.h"
+
+// Множество на АВЛ-дереве для одновременной работы многих потоков
+// Оптимистичная блокировка с передачей (optimistic lock coupling): у каждого узла есть версия.
+// Читатели ничего не блокируют: спускаются, запоминая версии, и проверяют, что узел
+// не изменился, прежде чем перейти к ребёнку; при изменении спуск начинается заново.
+// Писатели блокируют только узлы, которые меняют, всегда сверху вниз (родитель, затем ребёнок).
+// Удаление узла с двумя детьми - логическое (значение помечается отсутствующим), узлы с одним
+// ребёнком вырезаются. Балансировка ослабленная: после изменения путь поднимается с поворотами,
+// а если дерево на пути успели изменить другие потоки, подъём прекращается.
+// Каждая операция закрепляет эпоху (epoch.h), вырезанные узлы откладываются и освобождаются,
+// когда их уже не может читать ни один поток. Это касается только узлов ConcurrentTree:
+// BinaryTree и Set освобождают узлы сразу и для работы из многих потоков по-прежнему требуют блокировки
+template <typename T>
+class ConcurrentTree {
+  // Версия узла: бит 0 - узел вырезан из дерева, бит 1 - заблокирован, остальные - счётчик изменений
+  class VersionLock {
+    std::atomic<uint64_t> version{0};
+
+   public:
+    static bool obsolete(uint64_t v) {
+      return v & 1;
+    }
+    static bool locked(uint64_t v) {
+      return v & 2;
+    }
+    // Версия для оптимистичного чтения: ждём, пока писатель отпустит узел
+    uint64_t readVersion() const {
+      uint64_t v = version.load(std::memory_order_acquire);
+      for (int spins = 0; locked(v); spins++) {
+        if (spins > 64) std::this_thread::yield();
+        v = version.load(std::memory_order_acquire);
+      }
+      return v;
+    }
+    // Узел не менялся с момента чтения версии v
+    bool validate(uint64_t v) const {
+      std::atomic_thread_fence(std::memory_order_acquire);
+      return version.load(std::memory_order_relaxed) == v;
+    }
+    // Заблокировать, если узел не менялся с момента чтения версии v
+    bool upgrade(uint64_t v) {
+      return !obsolete(v) && version.compare_exchange_strong(v, v + 2, std::memory_order_acquire);
+    }
+    // Заблокировать, дождавшись других писателей; false - узел уже вырезан из дерева
+    bool lock() {
+      while (true) {
+        uint64_t v = readVersion();
+        if (obsolete(v)) return false;
+        if (version.compare_exchange_weak(v, v + 2, std::memory_order_acquire)) return true;
+      }
+    }
+    void unlock() {
+      version.fetch_add(2, std::memory_order_release);
+    }
+    // Отпустить вырезанный узел: все, кто его читает, начнут спуск заново
+    void unlockObsolete() {
+      version.fetch_add(3, std::memory_order_release);
+    }
+  };
+  struct Node {
+    const T key;
+    std::atomic<Node *> left{nullptr};
+    std::atomic<Node *> right{nullptr};
+    std::atomic<int> height{1};
+    std::atomic<bool> present{true};  // false - значение удалено, а узел с двумя детьми остался в дереве
+    VersionLock lock;
+    explicit Node(const T &key) : key(key) {}
+    std::atomic<Node *> &child(bool isRight) {
+      return isRight ? right : left;
+    }
+  };
+  // Путь спуска от корня (для балансировки после изменения)
+  static constexpr int MAX_PATH = 128;
+  struct Path {
+    Node *nodes[MAX_PATH];
+    int depth = 0;
+    void push(Node *n) {
+      if (depth < MAX_PATH) nodes[depth++] = n;
+    }
+  };
+  // Где закончился спуск: node - узел со значением (nullptr - нет такого, место - ребёнок parent)
+  struct Position {
+    Node *parent;
+    uint64_t parentVersion;
+    Node *node;
+    uint64_t nodeVersion;
+    bool isRight;  // node - правый ребёнок parent
+  };
+
+  mutable Node holder{T()};  // Корень дерева - правый ребёнок holder; у holder нет родителя
+  std::atomic<int> size{0};
+
+  static int heightOf(const Node *n) {
+    return n ? n->height.load(std::memory_order_relaxed) : 0;
+  }
+  static bool equal(const T &a, const T &b) {
+    return !(a < b) && !(b < a);
+  }
+  // Оптимистичный спуск к значению v; false - на пути что-то изменилось, нужно начать заново
+  bool descend(const T &v, Position &pos, Path *path) const {
+    Node *p = &holder;
+    uint64_t pv = p->lock.readVersion();
+    bool isRight = true;
+    Node *n = p->right.load(std::memory_order_acquire);
+    if (path) {
+      path->depth = 0;
+      path->push(p);
+    }
+    while (true) {
+      if (!p->lock.validate(pv)) return false;  // Ребёнок прочитан, пока p не менялся
+      if (n == nullptr) {
+        pos = {p, pv, nullptr, 0, isRight};
+        return true;
+      }
+      uint64_t nv = n->lock.readVersion();
+      if (VersionLock::obsolete(nv) || !p->lock.validate(pv)) return false;  // n всё ещё ребёнок p
+      if (equal(v, n->key)) {
+        pos = {p, pv, n, nv, isRight};
+        return true;
+      }
+      if (path) path->push(n);
+      isRight = n->key < v;
+      Node *c = n->child(isRight).load(std::memory_order_acquire);
+      p = n;
+      pv = nv;
+      n = c;
+    }
+  }
+  void retire(Node *n) {
+    EpochManager::instance().retire(n);
+  }
+  // Наименьшее присутствующее значение больше *after (after == nullptr - наименьшее вообще)
+  // Один оптимистичный спуск находит следующий узел; если его значение удалено - ищем дальше
+  bool successor(const T *after, T &out) const {
+    EpochGuard guard;
+    while (true) {
+      const Node *found = nullptr;  // Последний узел, где спуск повернул влево
+      bool present = false;
+      Node *p = &holder;
+      uint64_t pv = p->lock.readVersion();
+      Node *n = p->right.load(std::memory_order_acquire);
+      bool restart = false;
+      while (true) {
+        if (!p->lock.validate(pv)) {  // Заодно подтверждает present, прочитанный в p
+          restart = true;
+          break;
+        }
+        if (n == nullptr) break;
+        uint64_t nv = n->lock.readVersion();
+        if (VersionLock::obsolete(nv) || !p->lock.validate(pv)) {
+          restart = true;
+          break;
+        }
+        bool goLeft = after == nullptr || *after < n->key;
+        if (goLeft) {
+          found = n;
+          present = n->present.load(std::memory_order_acquire);
+        }
+        Node *c = n->child(!goLeft).load(std::memory_order_acquire);
+        p = n;
+        pv = nv;
+        n = c;
+      }
+      if (restart) continue;
+      if (found == nullptr) return false;
+      if (present) {
+        out = found->key;
+        return true;
+      }
+      after = &found->key;  // Значение удалено логически - ищем следующее за ним
+    }
+  }
+  // Поворот в поддереве n (p, n заблокированы, n - ребёнок p со стороны isRight)
+  // Для левого перевеса: малый правый или большой правый поворот
+  void rotate(Node *p, bool isRight, Node *n, bool leftHeavy) {
+    Node *c = n->child(!leftHeavy).load(std::memory_order_relaxed);  // Более высокий ребёнок
+    c->lock.lock();  // Ребёнка заблокированного n никто не вырежет
+    Node *outer = c->child(!leftHeavy).load(std::memory_order_relaxed);
+    Node *inner = c->child(leftHeavy).load(std::memory_order_relaxed);
+    Node *other = n->child(leftHeavy).load(std::memory_order_relaxed);
+    if (heightOf(outer) >= heightOf(inner)) {  // Малый поворот: c поднимается на место n
+      n->child(!leftHeavy).store(inner, std::memory_order_release);
+      n->height.store(std::max(heightOf(inner), heightOf(other)) + 1, std::memory_order_relaxed);
+      c->child(leftHeavy).store(n, std::memory_order_release);
+      c->height.store(std::max(heightOf(outer), heightOf(n)) + 1, std::memory_order_relaxed);
+      p->child(isRight).store(c, std::memory_order_release);
+    } else {  // Большой поворот: внук g поднимается на место n
+      Node *g = inner;
+      g->lock.lock();
+      c->child(leftHeavy).store(g->child(!leftHeavy).load(std::memory_order_relaxed), std::memory_order_release);
+      n->child(!leftHeavy).store(g->child(leftHeavy).load(std::memory_order_relaxed), std::memory_order_release);
+      c->height.store(std::max(heightOf(outer), heightOf(c->child(leftHeavy))) + 1, std::memory_order_relaxed);
+      n->height.store(std::max(heightOf(other), heightOf(n->child(!leftHeavy))) + 1, std::memory_order_relaxed);
+      g->child(!leftHeavy).store(c, std::memory_order_release);
+      g->child(leftHeavy).store(n, std::memory_order_release);
+      g->height.store(std::max(heightOf(c), heightOf(n)) + 1, std::memory_order_relaxed);
+      p->child(isRight).store(g, std::memory_order_release);
+      g->lock.unlock();
+    }
+    c->lock.unlock();
+  }
+  // Восстановить узел n с родителем p: вырезать удалённый узел, пересчитать высоту, повернуть
+  // false - выше ничего не изменилось (или дерево успели перестроить), подъём можно закончить
+  bool fix(Node *p, Node *n) {
+    if (!p->lock.lock()) return false;
+    bool isRight = p->right.load(std::memory_order_relaxed) == n;
+    if (!isRight && p->left.load(std::memory_order_relaxed) != n) {
+      p->lock.unlock();
+      return false;
+    }
+    if (!n->lock.lock()) {
+      p->lock.unlock();
+      return false;
+    }
+    Node *l = n->left.load(std::memory_order_relaxed);
+    Node *r = n->right.load(std::memory_order_relaxed);
+    if (!n->present.load(std::memory_order_relaxed) && (!l || !r)) {  // Удалённый узел больше не нужен
+      p->child(isRight).store(l ? l : r, std::memory_order_release);
+      n->lock.unlockObsolete();
+      p->lock.unlock();
+      retire(n);
+      return true;
+    }
+    int hl = heightOf(l), hr = heightOf(r);
+    if (std::abs(hl - hr) > 1) {
+      rotate(p, isRight, n, hl > hr);
+    } else {
+      int h = std::max(hl, hr) + 1;
+      if (h == heightOf(n)) {
+        n->lock.unlock();
+        p->lock.unlock();
+        return false;
+      }
+      n->height.store(h, std::memory_order_relaxed);
+    }
+    n->lock.unlock();
+    p->lock.unlock();
+    return true;
+  }
+  // Подъём по пути спуска: path->nodes[i - 1] - родитель path->nodes[i] (если его не перевесили)
+  void rebalance(const Path &path) {
+    for (int i = path.depth - 1; i >= 1; i--) {
+      if (!fix(path.nodes[i - 1], path.nodes[i])) break;
+    }
+  }
+  template <class Visit>
+  void forEachNode(Visit visit) const {
+    std::vector<Node *> stack;
+    for (Node *n = holder.right.load(std::memory_order_acquire); n || !stack.empty();) {
+      if (n) {
+        stack.push_back(n);
+        n = n->left.load(std::memory_order_acquire);
+      } else {
+        n = stack.back();
+        stack.pop_back();
+        visit(n);
+        n = n->right.load(std::memory_order_acquire);
+      }
+    }
+  }
+
+ public:
+  ConcurrentTree() {
+    holder.present.store(false);
+  }
+  ConcurrentTree(const ConcurrentTree &) = delete;
+  ConcurrentTree &operator=(const ConcurrentTree &) = delete;
+  // Вырезанные узлы принадлежат EpochManager и освобождаются им
+  ~ConcurrentTree() {
+    std::vector<Node *> nodes;
+    forEachNode([&](Node *n) { nodes.push_back(n); });
+    for (Node *n : nodes) delete n;
+  }
+  // Количество значений
+  int getSize() const {
+    return size.load(std::memory_order_relaxed);
+  }
+  // Поиск без блокировок
+  bool find(const T &v) const {
+    EpochGuard guard;
+    while (true) {
+      Position pos;
+      if (!descend(v, pos, nullptr)) continue;
+      if (pos.node == nullptr) return false;
+      bool present = pos.node->present.load(std::memory_order_acquire);
+      if (pos.node->lock.validate(pos.nodeVersion)) return present;
+    }
+  }
+  // Добавить значение: false, если оно уже есть
+  bool insert(const T &v) {
+    EpochGuard guard;
+    Path path;
+    Node *created = nullptr;  // Узел создаём до блокировки родителя
+    while (true) {
+      Position pos;
+      if (!descend(v, pos, &path)) continue;
+      if (pos.node) {  // Узел с таким значением есть
+        Node *n = pos.node;
+        if (n->present.load(std::memory_order_acquire)) {
+          if (!n->lock.validate(pos.nodeVersion)) continue;
+          delete created;
+          return false;
+        }
+        if (!n->lock.upgrade(pos.nodeVersion)) continue;
+        n->present.store(true, std::memory_order_release);  // Возвращаем логически удалённое значение
+        n->lock.unlock();
+        size++;
+        delete created;
+        return true;
+      }
+      if (created == nullptr) created = new Node(v);
+      if (!pos.parent->lock.upgrade(pos.parentVersion)) continue;  // Место занято или узел изменился
+      pos.parent->child(pos.isRight).store(created, std::memory_order_release);
+      pos.parent->lock.unlock();
+      size++;
+      rebalance(path);
+      return true;
+    }
+  }
+  // Удалить значение: false, если его нет
+  bool remove(const T &v) {
+    EpochGuard guard;
+    Path path;
+    while (true) {
+      Position pos;
+      if (!descend(v, pos, &path)) continue;
+      Node *n = pos.node;
+      if (n == nullptr) return false;
+      if (!n->present.load(std::memory_order_acquire)) {
+        if (!n->lock.validate(pos.nodeVersion)) continue;
+        return false;
+      }
+      Node *p = pos.parent;
+      if (!p->lock.upgrade(pos.parentVersion)) continue;
+      if (!n->lock.upgrade(pos.nodeVersion)) {
+        p->lock.unlock();
+        continue;
+      }
+      n->present.store(false, std::memory_order_release);
+      Node *l = n->left.load(std::memory_order_relaxed);
+      Node *r = n->right.load(std::memory_order_relaxed);
+      if (l && r) {  // Два ребёнка: узел остаётся как разделитель
+        n->lock.unlock();
+        p->lock.unlock();
+      } else {
+        p->child(pos.isRight).store(l ? l : r, std::memory_order_release);
+        n->lock.unlockObsolete();
+        p->lock.unlock();
+        retire(n);
+      }
+      size--;
+      rebalance(path);
+      return true;
+    }
+  }
+  // Итератор по возрастанию, работающий одновременно с изменениями дерева
+  // Каждый шаг - отдельный поиск следующего значения, поэтому эпоха закрепляется только на шаг
+  // и долгий обход не задерживает освобождение памяти. Значения, которые были в дереве
+  // весь обход, будут пройдены ровно один раз; добавленные и удалённые во время обхода - как успеем
+  struct Iterator {
+    using iterator_category = std::forward_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = T;
+    using pointer = const T *;
+    using reference = const T &;
+
+    Iterator() = default;
+    explicit Iterator(const ConcurrentTree *tree) : tree(tree) {
+      if (!tree->successor(nullptr, value)) this->tree = nullptr;
+    }
+    reference operator*() const {
+      return value;
+    }
+    pointer operator->() const {
+      return &value;
+    }
+    Iterator &operator++() {
+      T current = value;
+      if (!tree->successor(&current, value)) tree = nullptr;
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator tmp = *this;
+      ++(*this);
+      return tmp;
+    }
+    friend bool operator==(const Iterator &a, const Iterator &b) {
+      return a.tree == b.tree && (a.tree == nullptr || (!(a.value < b.value) && !(b.value < a.value)));
+    }
+    friend bool operator!=(const Iterator &a, const Iterator &b) {
+      return !(a == b);
+    }
+
+   private:
+    const ConcurrentTree *tree = nullptr;  // nullptr - конец
+    T value{};                             // Копия текущего значения
+  };
+  Iterator begin() const {
+    return Iterator(this);
+  }
+  Iterator end() const {
+    return Iterator();
+  }
+  // == Для проверок и отладки: без одновременных изменений ==
+  // Значения по возрастанию
+  std::vector<T> toVector() const {
+    std::vector<T> res;
+    forEachNode([&](Node *n) {
+      if (n->present.load(std::memory_order_relaxed)) res.push_back(n->key);
+    });
+    return res;
+  }
+  int height() const {
+    return heightOf(holder.right.load(std::memory_order_acquire));
+  }
+  // Порядок значений и правильность высот; balanced - проверить ещё и АВЛ-баланс
+  void check(bool balanced = true) const {
+    const Node *prev = nullptr;
+    forEachNode([&](Node *n) {
+      assert(prev == nullptr || prev->key < n->key);
+      int hl = heightOf(n->left.load()), hr = heightOf(n->right.load());
+      if (balanced) {
+        assert(heightOf(n) == std::max(hl, hr) + 1);
+        assert(std::abs(hl - hr) <= 1);
+      }
+      prev = n;
+    });
+    (void)prev;
+  }
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Освобождение памяти по эпохам (epoch-based reclamation)
+// Поток, читающий общую структуру без блокировок, закрепляет текущую эпоху (EpochGuard).
+// Узел, вырезанный из структуры, не удаляется сразу, а откладывается (retire) с номером эпохи.
+// Глобальная эпоха продвигается, когда все закреплённые потоки дошли до текущей; узлы,
+// отложенные две эпохи назад, уже никто не может видеть - их память освобождается.
+// Защищены только структуры, которые сами закрепляют эпоху и откладывают узлы через retire:
+// ConcurrentTree (concurrenttree.h) и SkipListSet (skiplistset.h). BinaryTree и Set удаляют узлы
+// сразу через NodePool, поэтому одновременно читать и менять их можно только под внешней блокировкой
+class EpochManager {
+  // Отложенный объект и функция его удаления
+  struct Retired {
+    void *object;
+    void (*destroy)(void *);
+    uint64_t epoch;  // Эпоха, в которой объект вырезан
+  };
+  // Запись потока; записи завершившихся потоков достаются новым потокам вместе с отложенными объектами
+  struct alignas(64) Record {
+    std::atomic<uint64_t> epoch{0};  // Закреплённая эпоха, 0 - поток ничего не читает
+    std::atomic<bool> active{true};  // Запись занята потоком
+    Record *next = nullptr;
+    int depth = 0;                   // Вложенные закрепления
+    int sinceCollect = 0;            // Сколько объектов отложено с прошлой уборки
+    std::vector<Retired> retired;
+  };
+  static constexpr int COLLECT_EVERY = 64;  // Уборка после стольких отложенных объектов
+
+  std::atomic<uint64_t> global{1};
+  std::atomic<Record *> records{nullptr};
+
+  // Записи потока в этом объекте; при завершении потока освобождаются
+  struct ThreadRecord {
+    Record *record = nullptr;
+    ~ThreadRecord() {
+      if (record) record->active.store(false, std::memory_order_release);
+    }
+  };
+  Record *local() {
+    static thread_local ThreadRecord mine;
+    if (mine.record) return mine.record;
+    for (Record *r = records.load(std::memory_order_acquire); r; r = r->next) {
+      bool free = false;
+      if (!r->active.load(std::memory_order_relaxed) && r->active.compare_exchange_strong(free, true))
+        return mine.record = r;
+    }
+    Record *r = new Record;
+    r->next = records.load(std::memory_order_relaxed);
+    while (!records.compare_exchange_weak(r->next, r, std::memory_order_release)) {
+    }
+    return mine.record = r;
+  }
+  // Продвинуть эпоху, если все закреплённые потоки уже в текущей
+  void tryAdvance() {
+    uint64_t e = global.load(std::memory_order_seq_cst);
+    for (Record *r = records.load(std::memory_order_acquire); r; r = r->next) {
+      uint64_t pinned = r->epoch.load(std::memory_order_seq_cst);
+      if (pinned != 0 && pinned != e) return;
+    }
+    global.compare_exchange_strong(e, e + 1);
+  }
+  // Освободить свои объекты, отложенные не позже чем две эпохи назад
+  void reclaim(Record *r) {
+    uint64_t e = global.load(std::memory_order_seq_cst);
+    size_t kept = 0;
+    for (Retired &x : r->retired) {
+      if (x.epoch + 2 <= e)
+        x.destroy(x.object);
+      else
+        r->retired[kept++] = x;
+    }
+    r->retired.resize(kept);
+  }
+  EpochManager() = default;
+
+ public:
+  EpochManager(const EpochManager &) = delete;
+  EpochManager &operator=(const EpochManager &) = delete;
+  ~EpochManager() {
+    for (Record *r = records.load(); r;) {
+      for (Retired &x : r->retired) x.destroy(x.object);
+      Record *next = r->next;
+      delete r;
+      r = next;
+    }
+  }
+  // Общий для всех структур менеджер: живёт дольше всех потоков
+  static EpochManager &instance() {
+    static EpochManager manager;
+    return manager;
+  }
+  // Закрепить текущую эпоху: пока поток не открепится, видимые ему объекты не освобождаются
+  void pin() {
+    Record *r = local();
+    if (r->depth++ == 0) r->epoch.store(global.load(std::memory_order_relaxed), std::memory_order_seq_cst);
+  }
+  void unpin() {
+    Record *r = local();
+    if (--r->depth == 0) r->epoch.store(0, std::memory_order_release);
+  }
+  // Отложить удаление объекта, уже недостижимого для новых читателей
+  template <class Object>
+  void retire(Object *object) {
+    Record *r = local();
+    r->retired.push_back({object, [](void *p) { delete static_cast<Object *>(p); },
+                          global.load(std::memory_order_seq_cst)});
+    if (++r->sinceCollect >= COLLECT_EVERY) collect();
+  }
+  // Продвинуть эпоху, если можно, и освободить то, что этот поток отложил и что уже никто не видит
+  void collect() {
+    Record *r = local();
+    r->sinceCollect = 0;
+    tryAdvance();
+    reclaim(r);
+  }
+  // Сколько объектов этот поток отложил и ещё не освободил
+  size_t pending() {
+    return local()->retired.size();
+  }
+};
+
+// Закрепление эпохи на время жизни объекта (вложенные закрепления допустимы)
+class EpochGuard {
+  EpochManager &epochs;
+
+ public:
+  explicit EpochGuard(EpochManager &epochs = EpochManager::instance()) : epochs(epochs) {
+    epochs.pin();
+  }
+  EpochGuard(const EpochGuard &) = delete;
+  EpochGuard &operator=(const EpochGuard &) = delete;
+  ~EpochGuard() {
+    epochs.unpin();
+  }
+};
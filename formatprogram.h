@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Скомпилированная строка формата или порядка обхода дерева
+// Строка вида "(N)[L]{R}" разбирается один раз в короткую программу: N - значение узла, L и R - спуск
+// в левое и правое поддерево, подряд идущие остальные символы - один фрагмент текста.
+// Программа выполняется без рекурсии, явным стеком (кадр на уровень дерева), без разбора строки в узлах
+// и без виртуальных вызовов: действия передаются как шаблонные параметры и встраиваются
+class FormatProgram {
+ public:
+  static constexpr int MAX_DEPTH = 64;  // Как BinaryTree::MAX_HEIGHT
+
+  enum class Op : uint8_t { Value, Left, Right, Text };
+  struct Instruction {
+    Op op;
+    uint32_t offset = 0, length = 0;  // Для Text - фрагмент строки text
+  };
+
+ private:
+  std::vector<Instruction> code;
+  std::string text;  // Все фрагменты текста подряд
+
+ public:
+  FormatProgram() = default;
+  // withText == false - только порядок обхода (например "LNR"), остальные символы пропускаются
+  explicit FormatProgram(const char *format, bool withText = true) {
+    for (const char *f = format; *f; f++) {
+      switch (*f) {
+      case 'N':
+        code.push_back({Op::Value});
+        break;
+      case 'L':
+        code.push_back({Op::Left});
+        break;
+      case 'R':
+        code.push_back({Op::Right});
+        break;
+      default:
+        if (!withText) break;
+        if (!code.empty() && code.back().op == Op::Text)
+          code.back().length++;
+        else
+          code.push_back({Op::Text, (uint32_t)text.size(), 1});
+        text += *f;
+      }
+    }
+  }
+  const std::vector<Instruction> &instructions() const {
+    return code;
+  }
+
+  // Выполнить для дерева с корнем root: value(node) на N, literal(указатель, длина) на фрагментах текста
+  // leafAsValue - лист выводится одним значением, без текста формата (так печатает BinaryTree::toString)
+  template <class Node, class Value, class Literal>
+  void run(Node *root, Value &&value, Literal &&literal, bool leafAsValue = false) const {
+    struct Frame {
+      Node *node;
+      uint32_t pc;  // Следующая инструкция для этого узла
+    };
+    Frame stack[MAX_DEPTH];
+    int depth = 0;
+    if (root) stack[depth++] = {root, 0};
+    while (depth > 0) {
+      Frame &f = stack[depth - 1];
+      if (f.pc == 0 && leafAsValue && !f.node->left && !f.node->right) {
+        value(f.node);
+        depth--;
+        continue;
+      }
+      if (f.pc == code.size()) {
+        depth--;
+        continue;
+      }
+      const Instruction &ins = code[f.pc++];
+      Node *child = nullptr;
+      switch (ins.op) {
+      case Op::Value:
+        value(f.node);
+        break;
+      case Op::Text:
+        literal(text.data() + ins.offset, (size_t)ins.length);
+        break;
+      case Op::Left:
+        child = f.node->left;
+        break;
+      case Op::Right:
+        child = f.node->right;
+        break;
+      }
+      if (child == nullptr) continue;
+      if (f.pc == code.size()) {  // Последняя инструкция: кадр узла больше не нужен
+        f = {child, 0};
+      } else {
+        assert(depth < MAX_DEPTH);
+        stack[depth++] = {child, 0};
+      }
+    }
+  }
+  // Только порядок обхода: visit(node) на каждом N
+  template <class Node, class Visit>
+  void run(Node *root, Visit &&visit) const {
+    run(root, visit, [](const char *, size_t) {});
+  }
+};
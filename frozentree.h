@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <vector>
+
+// Неизменяемый снимок дерева поиска в раскладке Эйтцингера
+// Значения лежат одним массивом в порядке обхода в ширину: корень - keys[1],
+// потомки узла k - keys[2k] и keys[2k+1]. Поиск идёт без ветвлений по сравнению,
+// а узлы на несколько уровней вперёд подгружаются в кэш заранее
+template <typename T>
+class FrozenTree {
+  std::vector<T> keys;  // keys[0] не используется
+  size_t n = 0;         // Количество значений
+  // Сколько значений помещается в строку кэша: потомки через log2(B) уровней лежат рядом
+  static constexpr size_t B = sizeof(T) < 64 ? 64 / sizeof(T) : 1;
+
+  // Раскладываем отсортированную последовательность: обход ЛКП неявного дерева
+  template <class It>
+  void fill(It &it, size_t k) {
+    if (k > n) return;
+    fill(it, 2 * k);
+    keys[k] = *it;
+    ++it;
+    fill(it, 2 * k + 1);
+  }
+  // Следующий по возрастанию узел неявного дерева (0 - конец)
+  size_t next(size_t k) const {
+    if (2 * k + 1 <= n) {  // Самый левый в правом поддереве
+      k = 2 * k + 1;
+      while (2 * k <= n) k = 2 * k;
+      return k;
+    }
+    while (k & 1) k >>= 1;  // Поднимаемся, пока приходим справа
+    return k >> 1;
+  }
+  // Предыдущий по возрастанию узел (из конца - максимальный)
+  size_t prev(size_t k) const {
+    if (k == 0) {
+      k = n ? 1 : 0;
+      while (k && 2 * k + 1 <= n) k = 2 * k + 1;
+      return k;
+    }
+    if (2 * k <= n) {  // Самый правый в левом поддереве
+      k = 2 * k;
+      while (2 * k + 1 <= n) k = 2 * k + 1;
+      return k;
+    }
+    while (k > 1 && !(k & 1)) k >>= 1;  // Поднимаемся, пока приходим слева
+    return k >> 1;
+  }
+  // Индекс первого значения >= v, 0 если такого нет
+  size_t lowerBoundIndex(const T &v) const {
+    size_t k = 1;
+    while (k <= n) {
+#if defined(__GNUC__)
+      __builtin_prefetch(keys.data() + std::min(k * B, n));
+#endif
+      k = 2 * k + (keys[k] < v);  // Без ветвления: влево или вправо
+    }
+    // Последний шаг влево был в ответ: отбрасываем шаги вправо после него
+#if defined(__GNUC__)
+    return k >> __builtin_ffsll(~(long long)k);
+#else
+    while (k & 1) k >>= 1;
+    return k >> 1;
+#endif
+  }
+
+ public:
+  FrozenTree() = default;
+  // Построение за O(count) из count значений, упорядоченных по возрастанию
+  template <class It>
+  FrozenTree(It first, size_t count) : keys(count + 1), n(count) {
+    fill(first, 1);
+  }
+  size_t size() const {
+    return n;
+  }
+  // Поиск значения: указатель на него или nullptr
+  const T *find(const T &v) const {
+    size_t k = lowerBoundIndex(v);
+    return (k && !(v < keys[k])) ? &keys[k] : nullptr;
+  }
+  bool contains(const T &v) const {
+    return find(v) != nullptr;
+  }
+  // Итератор по возрастанию значений
+  struct Iterator {
+    using iterator_category = std::bidirectional_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = T;
+    using pointer = const T *;
+    using reference = const T &;
+
+    Iterator(const FrozenTree *tree, size_t k) : tree(tree), k(k) {}
+    reference operator*() const {
+      return tree->keys[k];
+    }
+    pointer operator->() const {
+      return &tree->keys[k];
+    }
+    Iterator &operator++() {
+      k = tree->next(k);
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator tmp = *this;
+      ++(*this);
+      return tmp;
+    }
+    Iterator &operator--() {
+      k = tree->prev(k);
+      return *this;
+    }
+    Iterator operator--(int) {
+      Iterator tmp = *this;
+      --(*this);
+      return tmp;
+    }
+    friend bool operator==(const Iterator &a, const Iterator &b) {
+      return a.k == b.k && a.tree == b.tree;
+    }
+    friend bool operator!=(const Iterator &a, const Iterator &b) {
+      return !(a == b);
+    }
+
+   private:
+    const FrozenTree *tree;
+    size_t k;  // Индекс в массиве, 0 - за последним значением
+  };
+  Iterator begin() const {
+    size_t k = n ? 1 : 0;
+    while (k && 2 * k <= n) k = 2 * k;
+    return Iterator(this, k);
+  }
+  Iterator end() const {
+    return Iterator(this, 0);
+  }
+  // Первое значение >= v
+  Iterator lowerBound(const T &v) const {
+    return Iterator(this, lowerBoundIndex(v));
+  }
+};
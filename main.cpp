@@ -8,11 +8,18 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cwchar>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
 
 #include "binarytree.h"
 #include "common.hpp"
+#include "concurrenttree.h"
+#include "mappedtree.h"
 #include "menu.h"
 #include "set.h"
+#include "shardedset.h"
+#include "skiplistset.h"
 
 using namespace std;
 
@@ -79,8 +86,406 @@ void treeImplementationSpeed() {
   wcout << typeid(tree).name() << " time = " << t << endl;
 }
 
+// Время в секундах от момента begin до текущего
+double secondsSince(chrono::steady_clock::time_point begin) {
+  auto elapsed_mcs = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin);
+  return elapsed_mcs.count() / 1e6;
+}
+
+// Замеряем вставку и удаление всего дерева при заданном способе выделения памяти под узлы
+void nodeAllocationSpeed(NodeAllocation allocation, const wchar_t *name, int numbers) {
+  auto begin = chrono::steady_clock::now();
+  auto *tree = new BinaryTree<int>(allocation);
+  for (int i = 0; i < numbers; i++) {
+    tree->insert((int)((i * 2654435761u) % numbers));  // Перемешанные ключи
+  }
+  double insertTime = secondsSince(begin);
+  begin = chrono::steady_clock::now();
+  delete tree;
+  double deleteTime = secondsSince(begin);
+  wcout << name << L": вставка " << insertTime << L" с (" << numbers / insertTime / 1e6 << L" млн/с), удаление дерева "
+        << deleteTime << L" с" << endl;
+}
+
+// Сравнение пула узлов с выделением каждого узла через new/delete
+void nodePoolSpeed() {
+  for (int numbers : {100000, 1000000, 10000000}) {
+    wcout << L"Количество элементов: " << numbers << endl;
+    nodeAllocationSpeed(NodeAllocation::Heap, L"  new/delete", numbers);
+    nodeAllocationSpeed(NodeAllocation::Pool, L"  пул узлов ", numbers);
+  }
+}
+
+template <class T>
+void tree_nodePoolSpeed(BinaryTree<T> &) {
+  wprintf(L"Сравнение пула узлов с new/delete: вставка и удаление дерева\n");
+  nodePoolSpeed();
+}
+
+// Поиск в дереве и в его снимке (раскладка Эйтцингера) на 10^6-10^8 ключах
+void frozenTreeSpeed() {
+  const int queries = 1000000;
+  for (int numbers : {1000000, 10000000, 100000000}) {
+    wcout << L"Количество элементов: " << numbers << endl;
+    try {
+      vector<int> keys(numbers);
+      for (int i = 0; i < numbers; i++) keys[i] = 2 * i;  // Чётные ключи: половина запросов - промахи
+      BinaryTree<int> tree;
+      tree.buildFromSorted(keys.begin(), numbers);
+      auto begin = chrono::steady_clock::now();
+      FrozenTree<int> frozen = tree.freeze();
+      wcout << L"  построение снимка: " << secondsSince(begin) << L" с" << endl;
+      vector<int> query(queries);
+      for (int &q : query) q = (int)((rand() * (long long)RAND_MAX + rand()) % (2LL * numbers));
+      long long found = 0;  // Чтобы компилятор не выбросил поиск
+      begin = chrono::steady_clock::now();
+      for (int q : query) found += tree.find(q) != nullptr;
+      double treeTime = secondsSince(begin);
+      begin = chrono::steady_clock::now();
+      for (int q : query) found -= frozen.contains(q);
+      double frozenTime = secondsSince(begin);
+      wcout << L"  BinaryTree::find: " << treeTime * 1e9 / queries << L" нс/запрос" << endl;
+      wcout << L"  FrozenTree::find: " << frozenTime * 1e9 / queries << L" нс/запрос" << endl;
+      if (found != 0) wcout << L"  Ошибка: результаты поиска различаются" << endl;
+    } catch (bad_alloc &) {
+      wcout << L"  Недостаточно памяти" << endl;
+    }
+  }
+}
+
+template <class T>
+void tree_frozenTreeSpeed(BinaryTree<T> &) {
+  wprintf(L"Сравнение поиска в дереве и в неизменяемом снимке\n");
+  frozenTreeSpeed();
+}
+
+// Вставка и удаление: рекурсивная реализация против итеративной
+void insertRemoveSpeed() {
+  for (int numbers : {100000, 1000000}) {
+    wcout << L"Количество элементов: " << numbers << endl;
+    vector<int> keys(numbers);
+    for (int i = 0; i < numbers; i++) keys[i] = (int)((i * 2654435761u) % numbers);
+    for (bool iterative : {false, true}) {
+      BinaryTree<int> tree;
+      auto begin = chrono::steady_clock::now();
+      for (int x : keys) iterative ? tree.insert(x) : tree.insertRecursive(x);
+      double insertTime = secondsSince(begin);
+      begin = chrono::steady_clock::now();
+      for (int x : keys) iterative ? tree.remove(x) : tree.removeRecursive(x);
+      double removeTime = secondsSince(begin);
+      wcout << (iterative ? L"  итеративно: " : L"  рекурсивно: ") << L"вставка " << numbers / insertTime / 1e6
+            << L" млн/с, удаление " << numbers / removeTime / 1e6 << L" млн/с" << endl;
+    }
+  }
+}
+
+template <class T>
+void tree_insertRemoveSpeed(BinaryTree<T> &) {
+  wprintf(L"Сравнение рекурсивных и итеративных вставки и удаления\n");
+  insertRemoveSpeed();
+}
+
+// Короткие просмотры диапазонов вперемешку с изменениями: прошивка перед каждым просмотром
+// против связей по возрастанию, которые поддерживаются при вставке и удалении
+void linkedScanSpeed() {
+  const int numbers = 1000000, width = 16;
+  vector<int> keys(numbers);
+  for (int i = 0; i < numbers; i++) keys[i] = (int)((i * 2654435761u) % numbers);
+  for (bool linked : {false, true}) {
+    BinaryTree<int> tree;
+    tree.keepLinks(linked);
+    auto begin = chrono::steady_clock::now();
+    for (int x : keys) tree.insert(x);
+    double insertTime = secondsSince(begin);
+    const int scans = linked ? 100000 : 100;  // Прошивка - O(n) на просмотр
+    long long sum = 0;
+    begin = chrono::steady_clock::now();
+    for (int i = 0; i < scans; i++) {
+      int lo = keys[i];
+      tree.remove(lo);
+      tree.insert(lo);
+      if (linked) {
+        tree.forRange(lo, lo + width - 1, [&](int x) { sum += x; });
+      } else {
+        tree.thread("LNR");
+        for (auto n = tree.lowerBound(lo); n != nullptr && n->value < lo + width; n = n->next) sum += n->value;
+      }
+    }
+    double scanTime = secondsSince(begin);
+    wcout << (linked ? L"  связи по возрастанию: " : L"  прошивка перед просмотром: ") << L"вставка "
+          << numbers / insertTime / 1e6 << L" млн/с, изменение и просмотр " << width << L" значений "
+          << scanTime / scans * 1e6 << L" мкс" << (sum > 0 ? L"" : L" - ОШИБКА") << endl;
+  }
+}
+
+template <class T>
+void tree_linkedScanSpeed(BinaryTree<T> &) {
+  wprintf(L"Просмотр диапазонов: прошивка перед каждым просмотром против поддерживаемых связей\n");
+  linkedScanSpeed();
+}
+
+// Поиск одинаковых деревьев среди многих: попарное сравнение с уже найденными образцами
+// против словаря по структурному хешу (совпадение хеша проверяется точным сравнением)
+void shapeDedupSpeed() {
+  const int trees = 20000, values = 64, orders = 500;
+  vector<BinaryTree<int>> forest(trees);
+  for (int t = 0; t < trees; t++) {
+    unsigned seed = (unsigned)(t % orders) * 2654435761u;  // orders разных порядков вставки => форм
+    for (int i = 0; i < values; i++) forest[t].insert((int)((i * 40503u + seed) % 1000));
+  }
+  auto begin = chrono::steady_clock::now();
+  vector<BinaryTree<int> *> samples;
+  for (auto &tree : forest) {
+    bool found = false;
+    for (auto *sample : samples) {
+      if (sample->match(tree)) {
+        found = true;
+        break;
+      }
+    }
+    if (!found) samples.push_back(&tree);
+  }
+  double pairwiseTime = secondsSince(begin);
+  begin = chrono::steady_clock::now();
+  unordered_multimap<uint64_t, BinaryTree<int> *> byHash;
+  int distinct = 0;
+  for (auto &tree : forest) {
+    auto range = byHash.equal_range(tree.structureHash());
+    bool found = false;
+    for (auto it = range.first; it != range.second && !found; ++it) found = it->second->match(tree);
+    if (!found) {
+      byHash.emplace(tree.structureHash(), &tree);
+      distinct++;
+    }
+  }
+  double hashTime = secondsSince(begin);
+  wcout << L"  деревьев: " << trees << L", различных: " << distinct << L", попарно " << pairwiseTime
+        << L" с, по хешу " << hashTime << L" с" << ((int)samples.size() == distinct ? L"" : L" - ОШИБКА") << endl;
+}
+
+template <class T>
+void tree_shapeDedupSpeed(BinaryTree<T> &) {
+  wprintf(L"Поиск одинаковых деревьев: попарное сравнение против структурного хеша\n");
+  shapeDedupSpeed();
+}
+
+// Пропускная способность (млн операций/с) при threads потоках: поиск с долей изменений writePercent
+// Изменения - поровну вставок и удалений случайных ключей из диапазона [0, keys)
+template <class Find, class Insert, class Remove>
+double concurrentThroughput(int threads, int writePercent, int keys, Find find, Insert insert, Remove remove) {
+  const int operations = 2000000;  // Всего на все потоки
+  vector<thread> workers;
+  atomic<int> found{0};  // Результаты поиска используются, чтобы его не выбросил оптимизатор
+  auto begin = chrono::steady_clock::now();
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      unsigned state = 2654435761u * (t + 1);
+      int hits = 0;
+      for (int i = 0; i < operations / threads; i++) {
+        state = state * 1664525u + 1013904223u;  // Линейный конгруэнтный генератор
+        int key = (int)((state >> 8) % keys);
+        int kind = (int)((state >> 4) % 200);  // < writePercent: вставка, < 2 * writePercent: удаление
+        if (kind < writePercent)
+          insert(key);
+        else if (kind < 2 * writePercent)
+          remove(key);
+        else
+          hits += find(key);
+      }
+      found += hits;
+    });
+  }
+  for (auto &w : workers) w.join();
+  return operations / secondsSince(begin) / 1e6;
+}
+
+// Количества потоков для замеров: 1, 2, 4, ... и все ядра
+vector<int> benchmarkThreadCounts() {
+  vector<int> threadCounts;
+  int maxThreads = max(1u, thread::hardware_concurrency());
+  for (int threads = 1; threads < maxThreads; threads *= 2) threadCounts.push_back(threads);
+  threadCounts.push_back(maxThreads);
+  return threadCounts;
+}
+
+// Пропускная способность BinaryTree под одним общим мьютексом (заполнен наполовину)
+double lockedTreeThroughput(int threads, int writePercent, int keys) {
+  BinaryTree<int> tree;
+  for (int i = 0; i < keys; i += 2) tree.insertUnique(i);
+  mutex m;
+  return concurrentThroughput(
+    threads, writePercent, keys,
+    [&](int x) {
+      lock_guard<mutex> guard(m);
+      return tree.find(x) != nullptr;
+    },
+    [&](int x) {
+      lock_guard<mutex> guard(m);
+      tree.insertUnique(x);
+    },
+    [&](int x) {
+      lock_guard<mutex> guard(m);
+      tree.remove(x);
+    });
+}
+
+// Дерево с оптимистичной блокировкой против BinaryTree под одним общим мьютексом
+void concurrentTreeSpeed() {
+  const int keys = 1000000;
+  for (int writePercent : {0, 10, 50}) {
+    wcout << L"Изменений: " << writePercent << L"%, поиска: " << 100 - writePercent << L"%" << endl;
+    for (int threads : benchmarkThreadCounts()) {
+      ConcurrentTree<int> concurrent;
+      for (int i = 0; i < keys; i += 2) concurrent.insert(i);  // Заполняем наполовину
+      double optimistic = concurrentThroughput(
+        threads, writePercent, keys, [&](int x) { return concurrent.find(x); }, [&](int x) { concurrent.insert(x); },
+        [&](int x) { concurrent.remove(x); });
+      double locked = lockedTreeThroughput(threads, writePercent, keys);
+      wcout << L"  потоков: " << threads << L", оптимистичная блокировка " << optimistic
+            << L" млн/с, общий мьютекс " << locked << L" млн/с" << endl;
+    }
+  }
+}
+
+// Список с пропусками без блокировок против BinaryTree под одним общим мьютексом
+void skipListSpeed() {
+  const int keys = 1000000;
+  for (int writePercent : {0, 10, 50}) {
+    wcout << L"Изменений: " << writePercent << L"%, поиска: " << 100 - writePercent << L"%" << endl;
+    for (int threads : benchmarkThreadCounts()) {
+      SkipListSet<int> skipList;
+      for (int i = 0; i < keys; i += 2) skipList.insert(i);
+      double lockFree = concurrentThroughput(
+        threads, writePercent, keys, [&](int x) { return skipList.find(x); }, [&](int x) { skipList.insert(x); },
+        [&](int x) { skipList.erase(x); });
+      double locked = lockedTreeThroughput(threads, writePercent, keys);
+      wcout << L"  потоков: " << threads << L", список с пропусками " << lockFree << L" млн/с, общий мьютекс "
+            << locked << L" млн/с" << endl;
+    }
+  }
+}
+
+// Множество с шардами по диапазонам ключей против BinaryTree под одним общим мьютексом
+void shardedSetSpeed() {
+  const int keys = 1000000;
+  for (int writePercent : {0, 10, 50}) {
+    wcout << L"Изменений: " << writePercent << L"%, поиска: " << 100 - writePercent << L"%" << endl;
+    for (int threads : benchmarkThreadCounts()) {
+      vector<int> half;
+      for (int i = 0; i < keys; i += 2) half.push_back(i);
+      ShardedSet<int> sharded(half.begin(), half.end());
+      double perShard = concurrentThroughput(
+        threads, writePercent, keys, [&](int x) { return sharded.find(x); }, [&](int x) { sharded.insert(x); },
+        [&](int x) { sharded.erase(x); });
+      double locked = lockedTreeThroughput(threads, writePercent, keys);
+      wcout << L"  потоков: " << threads << L", шардов: " << sharded.shardCount() << L", блокировка на шард "
+            << perShard << L" млн/с, общий мьютекс " << locked << L" млн/с" << endl;
+    }
+  }
+}
+
+// Сохранение и загрузка множества (контрольная точка): текст против двоичного формата
+void checkpointSpeed() {
+  for (int n : {100000, 1000000, 10000000}) {
+    vector<int> values(n);
+    for (int i = 0; i < n; i++) values[i] = 3 * i - n;
+    Set<int> s;
+    for (int x : values) s.insert(x);
+
+    auto begin = chrono::steady_clock::now();
+    string text = s.toString();
+    Set<int> fromText(text);
+    double textTime = secondsSince(begin);
+
+    begin = chrono::steady_clock::now();
+    stringstream binary;
+    s.save(binary);
+    Set<int> fromBinary;
+    fromBinary.load(binary);
+    double binaryTime = secondsSince(begin);
+
+    wcout << L"  элементов: " << n << L", текст " << textTime << L" с (" << text.size() / 1000000.0
+          << L" МБ), двоичный формат " << binaryTime << L" с (" << binary.str().size() / 1000000.0 << L" МБ)"
+          << (fromText.size() == n && fromBinary.size() == n ? L"" : L" - ОШИБКА") << endl;
+  }
+}
+
+// Запуск сервиса поиска: загрузка множества из двоичного файла против отображения готового образа в память
+void mappedImageSpeed() {
+  const int n = 10000000, lookups = 1000000;
+  string dataPath = (filesystem::temp_directory_path() / "laba3_set.bin").string();
+  string imagePath = (filesystem::temp_directory_path() / "laba3_set.img").string();
+  {
+    vector<int> values(n);
+    for (int i = 0; i < n; i++) values[i] = 2 * i;
+    Set<int> s;
+    for (int x : values) s.insert(x);
+    ofstream data(dataPath, ios::binary), image(imagePath, ios::binary);
+    s.save(data);
+    s.saveImage(image);
+  }
+  auto lookup = [&](auto &&contains) {
+    int found = 0;
+    for (int i = 0; i < lookups; i++) found += contains((int)((i * 2654435761u) % (2u * n)));
+    return found;
+  };
+
+  auto begin = chrono::steady_clock::now();
+  Set<int> loaded;
+  ifstream data(dataPath, ios::binary);
+  loaded.load(data);
+  double loadTime = secondsSince(begin);
+  begin = chrono::steady_clock::now();
+  int foundLoaded = lookup([&](int x) { return loaded.find(x); });
+  double loadedLookupTime = secondsSince(begin);
+
+  begin = chrono::steady_clock::now();
+  MappedTree<int> mapped(imagePath);
+  double mapTime = secondsSince(begin);
+  begin = chrono::steady_clock::now();
+  int foundMapped = lookup([&](int x) { return mapped.contains(x); });
+  double mappedLookupTime = secondsSince(begin);
+
+  wcout << L"  элементов: " << n << L", запуск: загрузка " << loadTime << L" с, отображение " << mapTime << L" с"
+        << endl;
+  wcout << L"  " << lookups << L" поисков: загруженное дерево " << loadedLookupTime << L" с, образ "
+        << mappedLookupTime << L" с" << (foundLoaded == foundMapped ? L"" : L" - ОШИБКА") << endl;
+  filesystem::remove(dataPath);
+  filesystem::remove(imagePath);
+}
+
+template <class T>
+void set_mappedImageSpeed(Set<T> &) {
+  wprintf(L"Запуск: загрузка из двоичного файла против отображения образа в память\n");
+  mappedImageSpeed();
+}
+
+template <class T>
+void set_checkpointSpeed(Set<T> &) {
+  wprintf(L"Сохранение и загрузка: текст против двоичного формата\n");
+  checkpointSpeed();
+}
+
 template <class T>
-void stack_addElementSpeed(BinaryTree<T> &tree) {
+void set_shardedSetSpeed(Set<T> &) {
+  wprintf(L"Многопоточный доступ: шарды по диапазонам ключей против дерева под общим мьютексом\n");
+  shardedSetSpeed();
+}
+
+template <class T>
+void set_skipListSpeed(Set<T> &) {
+  wprintf(L"Многопоточный доступ: список с пропусками без блокировок против дерева под общим мьютексом\n");
+  skipListSpeed();
+}
+
+template <class T>
+void tree_concurrentTreeSpeed(BinaryTree<T> &) {
+  wprintf(L"Многопоточный доступ: оптимистичная блокировка узлов против общего мьютекса\n");
+  concurrentTreeSpeed();
+}
+
+template <class T>
+void stack_addElementSpeed(BinaryTree<T> &) {
   wprintf(L"Сравнение времени добавления элементов в дерево\n");
   treeImplementationSpeed();
 }
@@ -446,7 +851,13 @@ void tree_menu() {
       {
         L"Время добавления элементов в дерево на основе LinkedList",
         stack_addElementSpeed<T>
-      }
+      },
+      {L"Скорость вставки и удаления: пул узлов против new/delete", tree_nodePoolSpeed<T>},
+      {L"Скорость поиска: дерево против снимка в раскладке Эйтцингера", tree_frozenTreeSpeed<T>},
+      {L"Скорость вставки и удаления: рекурсия против итеративного спуска", tree_insertRemoveSpeed<T>},
+      {L"Просмотр диапазонов: прошивка перед просмотром против связей по возрастанию", tree_linkedScanSpeed<T>},
+      {L"Поиск одинаковых деревьев: попарное сравнение против структурного хеша", tree_shapeDedupSpeed<T>},
+      {L"Многопоточный доступ: оптимистичная блокировка против общего мьютекса", tree_concurrentTreeSpeed<T>}
     },
     bt};
 }
@@ -461,6 +872,10 @@ void set_menu() {
       {L"map, reduce, where", set_map_reduce_where<T>},
       {L"Операции над множествами: объединение, пересечение, вычитание", set_union_intersection_difference<T>},
       {L"Проверка на включение (подмножества), на равенство (двух множеств)", set_subset_equals<T>},
+      {L"Многопоточный доступ: список с пропусками против общего мьютекса", set_skipListSpeed<T>},
+      {L"Многопоточный доступ: шарды по диапазонам ключей против общего мьютекса", set_shardedSetSpeed<T>},
+      {L"Сохранение и загрузка: текст против двоичного формата", set_checkpointSpeed<T>},
+      {L"Запуск: загрузка из файла против отображения образа в память", set_mappedImageSpeed<T>},
     },
     s};
 }
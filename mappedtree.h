@@ -0,0 +1,375 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "common.hpp"
+#include "serialization.h"
+
+// Образ дерева поиска для отображения файла в память (mmap): запросы идут прямо по байтам файла,
+// без разбора и без выделения памяти. Формат (порядок байт - машины, на которой записан):
+//   заголовок MappedHeader (32 байта)
+//   count узлов MappedNode<T> по возрастанию значений (порядок ЛКП)
+// Вместо указателей в узлах - смещения до потомков в узлах относительно самого узла (0 - потомка нет),
+// поэтому образ не зависит от адреса, по которому отображён. Форма дерева та же, что у исходного BinaryTree
+struct MappedHeader {
+  static constexpr char MAGIC[4] = {'L', 'B', '3', 'M'};
+  static constexpr uint32_t ENDIAN = 0x01020304;  // Записывается как есть: на чужом порядке байт не совпадёт
+  static constexpr uint16_t VERSION = 1;
+
+  char magic[4];
+  uint32_t endian;
+  uint16_t version;
+  uint8_t typeTag;   // BinaryFormat::typeTag<T>()
+  uint8_t flags;     // BinaryFormat::DISTINCT для множества
+  uint32_t nodeSize;
+  uint64_t count;
+  int64_t root;      // Номер корня, -1 для пустого дерева
+};
+static_assert(sizeof(MappedHeader) == 32, "Заголовок образа - ровно 32 байта");
+
+template <class T>
+struct MappedNode {
+  T value;
+  int32_t left;   // Смещение до левого потомка (отрицательное) или 0
+  int32_t right;  // Смещение до правого потомка (положительное) или 0
+};
+
+// Запись образа: узлы дерева по возрастанию, смещения до потомков считаются по размерам поддеревьев
+// Node - узел BinaryTree (value, left, right, count)
+template <class T>
+class MappedTreeWriter {
+  std::ostream &out;
+  std::vector<MappedNode<T>> buffer;
+
+  template <class Node>
+  static int sizeOf(const Node *n) {
+    return n ? n->count : 0;
+  }
+  template <class Node>
+  void writeNodes(const Node *n) {
+    if (n == nullptr) return;
+    writeNodes(n->left);
+    MappedNode<T> m;
+    std::memset(&m, 0, sizeof(m));  // Байты выравнивания - тоже нули: одинаковые деревья дают одинаковые файлы
+    m.value = n->value;
+    // Левый потомок - последний в ЛКП среди левого поддерева, перед ним - его правое поддерево
+    m.left = n->left ? -(1 + sizeOf(n->left->right)) : 0;
+    m.right = n->right ? 1 + sizeOf(n->right->left) : 0;
+    buffer.push_back(m);
+    if (buffer.size() == BUFFER_NODES) flush();
+    writeNodes(n->right);
+  }
+  void flush() {
+    out.write(reinterpret_cast<const char *>(buffer.data()), buffer.size() * sizeof(MappedNode<T>));
+    buffer.clear();
+  }
+
+ public:
+  static constexpr size_t BUFFER_NODES = 4096;
+
+  explicit MappedTreeWriter(std::ostream &out) : out(out) {
+    buffer.reserve(BUFFER_NODES);
+  }
+  template <class Node>
+  void write(const Node *root, uint8_t flags) {
+    MappedHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, MappedHeader::MAGIC, 4);
+    h.endian = MappedHeader::ENDIAN;
+    h.version = MappedHeader::VERSION;
+    h.typeTag = BinaryFormat::typeTag<T>();
+    h.flags = flags;
+    h.nodeSize = sizeof(MappedNode<T>);
+    h.count = sizeOf(root);
+    h.root = root ? sizeOf(root->left) : -1;
+    out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    writeNodes(root);
+    flush();
+    out.flush();
+    if (!out) throw std::runtime_error("MappedTreeWriter: ошибка записи");
+  }
+};
+
+// Неизменяемое дерево поиска поверх образа в памяти
+// Либо само отображает файл (и освобождает отображение в деструкторе), либо смотрит на чужой буфер
+template <class T>
+class MappedTree {
+  const MappedNode<T> *nodes = nullptr;
+  size_t n = 0;
+  int64_t root = -1;
+  // Отображение файла, которым владеет дерево
+  void *mapping = nullptr;
+  size_t mappingSize = 0;
+#if defined(_WIN32)
+  std::vector<char> fileCopy;  // Без mmap файл читается в память целиком
+#endif
+
+  // Проверка заголовка за O(1); узлы не читаются
+  void attach(const void *data, size_t size) {
+    if (size < sizeof(MappedHeader)) throw FormatError("Образ дерева: файл короче заголовка");
+    const MappedHeader &h = *static_cast<const MappedHeader *>(data);
+    if (std::memcmp(h.magic, MappedHeader::MAGIC, 4) != 0) throw FormatError("Образ дерева: неверная сигнатура");
+    if (h.endian != MappedHeader::ENDIAN) throw FormatError("Образ дерева: другой порядок байт");
+    if (h.version != MappedHeader::VERSION) throw FormatError("Образ дерева: неподдерживаемая версия");
+    if (h.typeTag != BinaryFormat::typeTag<T>() || h.nodeSize != sizeof(MappedNode<T>))
+      throw FormatError("Образ дерева: другой тип значений");
+    if (h.count > (size - sizeof(MappedHeader)) / sizeof(MappedNode<T>)) throw FormatError("Образ дерева: файл обрезан");
+    if (h.count == 0 ? h.root != -1 : (h.root < 0 || (uint64_t)h.root >= h.count))
+      throw FormatError("Образ дерева: неверный корень");
+    nodes = reinterpret_cast<const MappedNode<T> *>(static_cast<const char *>(data) + sizeof(MappedHeader));
+    n = h.count;
+    root = h.root;
+  }
+  void unmap() {
+#if !defined(_WIN32)
+    if (mapping) munmap(mapping, mappingSize);
+#endif
+    mapping = nullptr;
+    mappingSize = 0;
+  }
+  // Номер первого узла со значением >= v (или > v при strict), n - если такого нет
+  size_t bound(const T &v, bool strict) const {
+    size_t res = n;
+    int64_t k = root;
+    while (k >= 0) {
+      const MappedNode<T> &node = nodes[k];
+      bool right = strict ? !(v < node.value) : node.value < v;
+      if (!right) res = (size_t)k;
+      int32_t step = right ? node.right : node.left;
+      k = step ? k + step : -1;
+    }
+    return res;
+  }
+
+ public:
+  MappedTree() = default;
+  // Дерево поверх образа, лежащего в памяти (буфер должен жить дольше дерева и быть выровнен на 8)
+  MappedTree(const void *data, size_t size) {
+    attach(data, size);
+  }
+  // Отобразить файл образа в память только для чтения
+  explicit MappedTree(const std::string &path) {
+#if defined(_WIN32)
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("MappedTree: не удалось открыть " + path);
+    fileCopy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    attach(fileCopy.data(), fileCopy.size());
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("MappedTree: не удалось открыть " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      throw std::runtime_error("MappedTree: не удалось узнать размер " + path);
+    }
+    mappingSize = (size_t)st.st_size;
+    void *p = mappingSize ? mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);  // Отображение остаётся и после закрытия файла
+    if (p == MAP_FAILED) throw FormatError("Образ дерева: не удалось отобразить " + path);
+    mapping = p;
+    try {
+      attach(mapping, mappingSize);
+    } catch (...) {
+      unmap();
+      throw;
+    }
+#endif
+  }
+  MappedTree(const MappedTree &) = delete;
+  MappedTree &operator=(const MappedTree &) = delete;
+  MappedTree(MappedTree &&other) noexcept {
+    swap(other);
+  }
+  MappedTree &operator=(MappedTree &&other) noexcept {
+    MappedTree moved(std::move(other));
+    swap(moved);
+    return *this;
+  }
+  void swap(MappedTree &other) noexcept {
+    std::swap(nodes, other.nodes);
+    std::swap(n, other.n);
+    std::swap(root, other.root);
+    std::swap(mapping, other.mapping);
+    std::swap(mappingSize, other.mappingSize);
+#if defined(_WIN32)
+    std::swap(fileCopy, other.fileCopy);
+#endif
+  }
+  ~MappedTree() {
+    unmap();
+  }
+
+  size_t size() const {
+    return n;
+  }
+  // Поиск значения: указатель на него (внутри образа) или nullptr
+  const T *find(const T &v) const {
+    size_t k = bound(v, false);
+    return (k < n && !(v < nodes[k].value)) ? &nodes[k].value : nullptr;
+  }
+  bool contains(const T &v) const {
+    return find(v) != nullptr;
+  }
+  // Полная проверка образа из ненадёжного источника за O(n): значения упорядочены, а потомки каждого узла
+  // лежат внутри отрезка номеров его поддерева - тогда любой спуск от корня конечен
+  void verify() const {
+    for (size_t k = 1; k < n; k++) {
+      if (nodes[k].value < nodes[k - 1].value) throw FormatError("Образ дерева: значения не упорядочены");
+    }
+    struct Span {
+      int64_t k, lo, hi;  // Узел и отрезок номеров [lo, hi], в котором должно лежать его поддерево
+    };
+    std::vector<Span> stack;
+    if (n) stack.push_back({root, 0, (int64_t)n - 1});
+    size_t visited = 0;
+    while (!stack.empty()) {
+      Span s = stack.back();
+      stack.pop_back();
+      visited++;
+      const MappedNode<T> &node = nodes[s.k];
+      int64_t l = s.k + node.left, r = s.k + node.right;
+      if (node.left > 0 || l < s.lo || node.right < 0 || r > s.hi)
+        throw FormatError("Образ дерева: неверное смещение потомка");
+      if (node.left) stack.push_back({l, s.lo, s.k - 1});
+      if (node.right) stack.push_back({r, s.k + 1, s.hi});
+    }
+    if (visited != n) throw FormatError("Образ дерева: не все узлы достижимы из корня");
+  }
+
+  // Узлы лежат по возрастанию значений, поэтому итератор - просто указатель на узел
+  struct Iterator {
+    using iterator_category = std::random_access_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = T;
+    using pointer = const T *;
+    using reference = const T &;
+
+    Iterator() = default;
+    explicit Iterator(const MappedNode<T> *node) : node(node) {}
+    reference operator*() const {
+      return node->value;
+    }
+    pointer operator->() const {
+      return &node->value;
+    }
+    Iterator &operator++() {
+      ++node;
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator tmp = *this;
+      ++node;
+      return tmp;
+    }
+    Iterator &operator--() {
+      --node;
+      return *this;
+    }
+    Iterator operator--(int) {
+      Iterator tmp = *this;
+      --node;
+      return tmp;
+    }
+    Iterator &operator+=(difference_type d) {
+      node += d;
+      return *this;
+    }
+    Iterator &operator-=(difference_type d) {
+      node -= d;
+      return *this;
+    }
+    Iterator operator+(difference_type d) const {
+      return Iterator(node + d);
+    }
+    friend Iterator operator+(difference_type d, const Iterator &it) {
+      return Iterator(it.node + d);
+    }
+    Iterator operator-(difference_type d) const {
+      return Iterator(node - d);
+    }
+    difference_type operator-(const Iterator &other) const {
+      return node - other.node;
+    }
+    reference operator[](difference_type d) const {
+      return node[d].value;
+    }
+    friend bool operator==(const Iterator &a, const Iterator &b) {
+      return a.node == b.node;
+    }
+    friend bool operator!=(const Iterator &a, const Iterator &b) {
+      return a.node != b.node;
+    }
+    friend bool operator<(const Iterator &a, const Iterator &b) {
+      return a.node < b.node;
+    }
+    friend bool operator>(const Iterator &a, const Iterator &b) {
+      return a.node > b.node;
+    }
+    friend bool operator<=(const Iterator &a, const Iterator &b) {
+      return a.node <= b.node;
+    }
+    friend bool operator>=(const Iterator &a, const Iterator &b) {
+      return a.node >= b.node;
+    }
+
+   private:
+    const MappedNode<T> *node = nullptr;
+  };
+  Iterator begin() const {
+    return Iterator(nodes);
+  }
+  Iterator end() const {
+    return Iterator(nodes + n);
+  }
+  // Первое значение >= v
+  Iterator lowerBound(const T &v) const {
+    return Iterator(nodes + bound(v, false));
+  }
+  // Первое значение > v
+  Iterator upperBound(const T &v) const {
+    return Iterator(nodes + bound(v, true));
+  }
+  // Значения из отрезка [lo, hi] - для range-for
+  struct Range {
+    Iterator first, last;
+    Iterator begin() const {
+      return first;
+    }
+    Iterator end() const {
+      return last;
+    }
+  };
+  Range range(const T &lo, const T &hi) const {
+    Iterator first = lowerBound(lo), last = upperBound(hi);
+    return {first, last < first ? first : last};
+  }
+  // Свёртка всех значений по возрастанию: f(f(x0, x1), x2)...
+  template <class F>
+  T reduce(F f) const {
+    if (n == 0) throw std::range_error("Empty tree");
+    T res = nodes[0].value;
+    for (size_t k = 1; k < n; k++) res = f(res, nodes[k].value);
+    return res;
+  }
+  // Свёртка значений из отрезка [lo, hi], начиная с init
+  template <class F>
+  T reduceRange(const T &lo, const T &hi, F f, T init) const {
+    for (const T &x : range(lo, hi)) init = f(init, x);
+    return init;
+  }
+};
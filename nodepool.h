@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Способ выделения памяти под узлы дерева
+enum class NodeAllocation {
+  Pool,  // Узлы нарезаются из больших блоков пула (по умолчанию)
+  Heap   // Каждый узел отдельно через new/delete
+};
+
+// Пул узлов (slab-аллокатор)
+// Узлы нарезаются из больших блоков памяти, освобождённые узлы попадают
+// в список свободных и используются повторно. Вся память возвращается за O(количество блоков)
+template <typename Node>
+class NodePool {
+  // Ячейка блока: либо живой узел, либо ссылка на следующую свободную ячейку
+  union Slot {
+    Slot *nextFree;
+    alignas(Node) unsigned char storage[sizeof(Node)];
+  };
+  static constexpr size_t FIRST_CHUNK = 64;     // Размер первого блока (в узлах)
+  static constexpr size_t MAX_CHUNK = 1 << 16;  // Максимальный размер блока (в узлах)
+
+  NodeAllocation mode;
+  std::vector<Slot *> chunks;  // Выделенные блоки
+  Slot *freeList = nullptr;    // Список освобождённых ячеек
+  size_t chunkSize = 0;        // Размер последнего блока
+  size_t used = 0;             // Сколько ячеек последнего блока уже выдано
+
+  void *allocate() {
+    if (freeList) {  // Сначала используем освобождённые ячейки
+      Slot *s = freeList;
+      freeList = s->nextFree;
+      return s;
+    }
+    if (used == chunkSize) {  // Последний блок закончился => выделяем новый, вдвое больше
+      chunkSize = chunkSize ? std::min(chunkSize * 2, MAX_CHUNK) : FIRST_CHUNK;
+      chunks.push_back(static_cast<Slot *>(::operator new(chunkSize * sizeof(Slot))));
+      used = 0;
+    }
+    return &chunks.back()[used++];
+  }
+  void deallocate(void *p) {
+    Slot *s = static_cast<Slot *>(p);
+    s->nextFree = freeList;
+    freeList = s;
+  }
+
+ public:
+  explicit NodePool(NodeAllocation mode = NodeAllocation::Pool) : mode(mode) {}
+  NodePool(const NodePool &) = delete;
+  NodePool &operator=(const NodePool &) = delete;
+  NodePool(NodePool &&other) noexcept
+      : mode(other.mode), chunks(std::move(other.chunks)), freeList(other.freeList), chunkSize(other.chunkSize),
+        used(other.used) {
+    other.chunks.clear();
+    other.freeList = nullptr;
+    other.chunkSize = other.used = 0;
+  }
+  NodePool &operator=(NodePool &&other) noexcept {
+    if (this != &other) {
+      release();
+      mode = other.mode;
+      std::swap(chunks, other.chunks);
+      std::swap(freeList, other.freeList);
+      std::swap(chunkSize, other.chunkSize);
+      std::swap(used, other.used);
+    }
+    return *this;
+  }
+  ~NodePool() {
+    release();
+  }
+  bool pooled() const {
+    return mode == NodeAllocation::Pool;
+  }
+  // Создать узел с заданными параметрами конструктора
+  template <class... Args>
+  Node *create(Args &&...args) {
+    if (!pooled()) return new Node(std::forward<Args>(args)...);
+    void *p = allocate();
+    try {
+      return new (p) Node(std::forward<Args>(args)...);
+    } catch (...) {
+      deallocate(p);
+      throw;
+    }
+  }
+  // Уничтожить узел: ячейка возвращается в список свободных
+  void destroy(Node *n) {
+    if (!pooled()) {
+      delete n;
+      return;
+    }
+    n->~Node();
+    deallocate(n);
+  }
+  // Забрать себе все блоки и свободные ячейки другого пула - O(количество блоков + свободных ячеек)
+  // Невыданный остаток последнего блока other не используется
+  void adopt(NodePool &other) {
+    if (this == &other) return;
+    Slot *tail = other.freeList;
+    if (tail) {
+      while (tail->nextFree) tail = tail->nextFree;
+      tail->nextFree = freeList;
+      freeList = other.freeList;
+    }
+    // Свой последний блок оставляем последним, чтобы продолжать выдавать ячейки из него
+    chunks.insert(chunks.empty() ? chunks.end() : chunks.end() - 1, other.chunks.begin(), other.chunks.end());
+    other.chunks.clear();
+    other.freeList = nullptr;
+    other.chunkSize = other.used = 0;
+  }
+  // Освободить все блоки разом. Деструкторы узлов не вызываются!
+  void release() {
+    for (Slot *c : chunks) ::operator delete(c);
+    chunks.clear();
+    freeList = nullptr;
+    chunkSize = used = 0;
+  }
+};
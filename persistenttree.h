@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <utility>
+
+// Персистентное АВЛ-дерево поиска
+// Узлы неизменяемы и разделяются между версиями через счётчики ссылок (shared_ptr).
+// Изменение копирует только путь от корня до изменённого места - O(log n) узлов,
+// поэтому снимок (snapshot) и поддерево (subTree) получаются за O(1),
+// а старые версии можно читать, пока пишется новая.
+// Один писатель может менять дерево, пока другие потоки берут снимки и читают их
+template <typename T>
+class PersistentTree {
+  struct Node;
+  using NodePtr = std::shared_ptr<const Node>;
+  struct Node {
+    T value;
+    NodePtr left;   // Левое поддерево
+    NodePtr right;  // Правое поддерево
+    int height;     // Высота поддерева с корнем в этой вершине
+    int count;      // Количество узлов в поддереве
+    Node(T value, NodePtr left, NodePtr right)
+        : value(std::move(value)), left(std::move(left)), right(std::move(right)) {
+      height = std::max(heightOf(this->left), heightOf(this->right)) + 1;
+      count = countOf(this->left) + 1 + countOf(this->right);
+    }
+  };
+
+  NodePtr root;  // Корень текущей версии; читается и заменяется атомарно
+
+  explicit PersistentTree(NodePtr root) : root(std::move(root)) {}
+  NodePtr load() const {
+    return std::atomic_load(&root);
+  }
+  void store(NodePtr r) {
+    std::atomic_store(&root, std::move(r));
+  }
+  static int heightOf(const NodePtr &n) {
+    return n ? n->height : 0;
+  }
+  static int countOf(const NodePtr &n) {
+    return n ? n->count : 0;
+  }
+  static const Node *findNode(const Node *n, const T &v) {
+    while (n != nullptr) {
+      if (v < n->value)
+        n = n->left.get();
+      else if (n->value < v)
+        n = n->right.get();
+      else
+        return n;
+    }
+    return nullptr;
+  }
+  static NodePtr make(T value, NodePtr left, NodePtr right) {
+    return std::make_shared<const Node>(std::move(value), std::move(left), std::move(right));
+  }
+  // Новый узел со значением v и поддеревьями l и r, высоты которых отличаются не больше чем на 2
+  // Если нужно - поворот; повёрнутые узлы создаются заново, остальные разделяются со старой версией
+  static NodePtr balance(T v, NodePtr l, NodePtr r) {
+    if (heightOf(l) > heightOf(r) + 1) {
+      if (heightOf(l->left) >= heightOf(l->right))  // Малый правый поворот
+        return make(l->value, l->left, make(std::move(v), l->right, std::move(r)));
+      // Большой правый поворот
+      return make(l->right->value, make(l->value, l->left, l->right->left),
+                  make(std::move(v), l->right->right, std::move(r)));
+    }
+    if (heightOf(r) > heightOf(l) + 1) {
+      if (heightOf(r->right) >= heightOf(r->left))  // Малый левый поворот
+        return make(r->value, make(std::move(v), std::move(l), r->left), r->right);
+      // Большой левый поворот
+      return make(r->left->value, make(std::move(v), std::move(l), r->left->left),
+                  make(r->value, r->left->right, r->right));
+    }
+    return make(std::move(v), std::move(l), std::move(r));
+  }
+  // Вставка: значения <= значения в узле идут влево (как в BinaryTree)
+  static NodePtr insertTo(const NodePtr &n, const T &v) {
+    if (!n) return make(v, nullptr, nullptr);
+    if (v <= n->value) return balance(n->value, insertTo(n->left, v), n->right);
+    return balance(n->value, n->left, insertTo(n->right, v));
+  }
+  // Удаление минимального узла поддерева, его значение записывается в min
+  static NodePtr removeMin(const NodePtr &n, T &min) {
+    if (!n->left) {
+      min = n->value;
+      return n->right;
+    }
+    return balance(n->value, removeMin(n->left, min), n->right);
+  }
+  // Удаление одного узла со значением v; если его нет - возвращается n без изменений
+  static NodePtr removeFrom(const NodePtr &n, const T &v, bool &removed) {
+    if (!n) return n;
+    if (v < n->value) {
+      NodePtr l = removeFrom(n->left, v, removed);
+      return removed ? balance(n->value, std::move(l), n->right) : n;
+    }
+    if (n->value < v) {
+      NodePtr r = removeFrom(n->right, v, removed);
+      return removed ? balance(n->value, n->left, std::move(r)) : n;
+    }
+    removed = true;
+    if (!n->left) return n->right;
+    if (!n->right) return n->left;
+    T successor = n->value;  // Заменяем значение на следующее по возрастанию
+    NodePtr r = removeMin(n->right, successor);
+    return balance(std::move(successor), n->left, std::move(r));
+  }
+  // Построение идеально сбалансированного дерева из count отсортированных значений за O(count)
+  template <class It>
+  static NodePtr build(It &it, size_t count) {
+    if (count == 0) return nullptr;
+    NodePtr left = build(it, count / 2);
+    T value = *it;
+    ++it;
+    NodePtr right = build(it, count - count / 2 - 1);
+    return make(std::move(value), std::move(left), std::move(right));
+  }
+
+ public:
+  // Предельная высота АВЛ-дерева (см. BinaryTree::MAX_HEIGHT)
+  static constexpr int MAX_HEIGHT = 64;
+
+  PersistentTree() = default;
+  // Дерево из count значений, упорядоченных по неубыванию, за O(count)
+  template <class It>
+  PersistentTree(It first, size_t count) : root(build(first, count)) {}
+  // Копирование разделяет все узлы - O(1)
+  PersistentTree(const PersistentTree &other) : root(other.load()) {}
+  PersistentTree &operator=(const PersistentTree &other) {
+    store(other.load());
+    return *this;
+  }
+  // Неизменяемая копия текущей версии за O(1)
+  PersistentTree snapshot() const {
+    return PersistentTree(load());
+  }
+  int getSize() const {
+    return countOf(load());
+  }
+  int height() const {
+    return heightOf(load());
+  }
+  // Вставка: копируется путь от корня до нового узла, прежние снимки не меняются
+  void insert(const T &value) {
+    store(insertTo(load(), value));
+  }
+  // Удаление одного значения, false - если его нет
+  bool remove(const T &value) {
+    bool removed = false;
+    NodePtr r = removeFrom(load(), value, removed);
+    if (removed) store(std::move(r));
+    return removed;
+  }
+  // Поиск: копия значения или пустой optional. Указатель на узел вернуть нельзя: после выхода
+  // из find версию может освободить писатель (для долгого чтения - snapshot())
+  std::optional<T> find(const T &v) const {
+    NodePtr version = load();  // Держим версию, пока идём по ней
+    const Node *n = findNode(version.get(), v);
+    if (n == nullptr) return std::nullopt;
+    return n->value;
+  }
+  bool contains(const T &v) const {
+    NodePtr version = load();
+    return findNode(version.get(), v) != nullptr;
+  }
+  // Поддерево с корнем в узле со значением v (пустое, если такого нет) - O(log n) на поиск,
+  // само поддерево не копируется
+  PersistentTree subTree(const T &v) const {
+    NodePtr n = load();
+    while (n && !(v == n->value)) n = (v < n->value) ? n->left : n->right;
+    return PersistentTree(std::move(n));
+  }
+  // Проверка инвариантов АВЛ-дерева поиска (для тестов)
+  void check() const {
+    check(load().get());
+  }
+  static void check(const Node *n) {
+    if (n == nullptr) return;
+    assert(n->height == std::max(heightOf(n->left), heightOf(n->right)) + 1);
+    assert(std::abs(heightOf(n->left) - heightOf(n->right)) <= 1);
+    assert(n->count == countOf(n->left) + 1 + countOf(n->right));
+    assert(!n->left || n->left->value <= n->value);
+    assert(!n->right || n->value <= n->right->value);
+    check(n->left.get());
+    check(n->right.get());
+  }
+
+  // Итератор по возрастанию значений. Держит свою версию дерева, поэтому
+  // обходит её целиком, даже если дерево тем временем изменилось
+  struct Iterator {
+    using iterator_category = std::forward_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = T;
+    using pointer = const T *;
+    using reference = const T &;
+
+    Iterator() = default;
+    explicit Iterator(NodePtr root) : version(std::move(root)) {
+      pushLeft(version.get());
+    }
+    reference operator*() const {
+      return path[depth - 1]->value;
+    }
+    pointer operator->() const {
+      return &path[depth - 1]->value;
+    }
+    Iterator &operator++() {
+      const Node *n = path[--depth];
+      pushLeft(n->right.get());
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator tmp = *this;
+      ++(*this);
+      return tmp;
+    }
+    friend bool operator==(const Iterator &a, const Iterator &b) {
+      if (a.depth == 0 || b.depth == 0) return a.depth == b.depth;
+      return a.path[a.depth - 1] == b.path[b.depth - 1];
+    }
+    friend bool operator!=(const Iterator &a, const Iterator &b) {
+      return !(a == b);
+    }
+
+   private:
+    NodePtr version;               // Обходимая версия
+    const Node *path[MAX_HEIGHT];  // Узлы, ждущие обхода: текущий - последний
+    int depth = 0;
+
+    void pushLeft(const Node *n) {
+      for (; n != nullptr; n = n->left.get()) {
+        assert(depth < MAX_HEIGHT);
+        path[depth++] = n;
+      }
+    }
+  };
+  Iterator begin() const {
+    return Iterator(load());
+  }
+  Iterator end() const {
+    return Iterator();
+  }
+};
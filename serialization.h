@@ -0,0 +1,207 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "common.hpp"
+
+// Двоичный формат дерева поиска и множества (версия 1), все числа - little-endian:
+//   заголовок: "LAB3", версия (2 байта), тип ключа (1 байт), флаги (1 байт), количество ключей (8 байт)
+//   ключи по неубыванию, по sizeof(T) байт
+//   контрольная сумма ключей (8 байт)
+// Контрольная сумма записана после ключей, чтобы писать за один проход по дереву.
+// Отсортированных ключей достаточно, чтобы построить сбалансированное дерево за O(n)
+struct BinaryFormat {
+  static constexpr char MAGIC[4] = {'L', 'A', 'B', '3'};
+  static constexpr uint16_t VERSION = 1;
+  static constexpr uint8_t DISTINCT = 1;          // Флаг: ключи строго возрастают (множество)
+  static constexpr size_t HEADER_SIZE = 16;
+  static constexpr size_t BUFFER_SIZE = 1 << 16;  // Кратен 8 - см. Checksum
+
+  // Тип ключа: размер, знаковость и вещественность
+  template <class T>
+  static constexpr uint8_t typeTag() {
+    static_assert(std::is_arithmetic<T>::value, "В двоичном формате хранятся только числовые ключи");
+    return (std::is_floating_point<T>::value ? 0x80 : 0) | (std::is_signed<T>::value ? 0x40 : 0) | sizeof(T);
+  }
+  // Перестановка байт на машинах с обратным порядком байт
+  template <class V>
+  static V littleEndian(V v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    unsigned char bytes[sizeof(V)];
+    std::memcpy(bytes, &v, sizeof(V));
+    std::reverse(bytes, bytes + sizeof(V));
+    std::memcpy(&v, bytes, sizeof(V));
+#endif
+    return v;
+  }
+
+  // Контрольная сумма: FNV-1a по 8-байтовым словам, неполное последнее слово дополняется нулями
+  // Данные можно подавать частями, если все части, кроме последней, кратны 8 байтам
+  class Checksum {
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+   public:
+    void add(const char *data, size_t size) {
+      size_t i = 0;
+      for (; i + 8 <= size; i += 8) mix(data + i, 8);
+      if (i < size) mix(data + i, size - i);
+    }
+    uint64_t value() const {
+      return hash;
+    }
+
+   private:
+    void mix(const char *data, size_t size) {
+      uint64_t word = 0;
+      std::memcpy(&word, data, size);
+      hash = (hash ^ littleEndian(word)) * 0x100000001b3ull;
+    }
+  };
+};
+
+// Буферизованная запись ключей в двоичном формате: заголовок пишется сразу,
+// ключи - блоками по BUFFER_SIZE байт, контрольная сумма - в finish()
+template <class T>
+class BinaryWriter {
+  std::ostream &out;
+  std::unique_ptr<char[]> buffer{new char[BinaryFormat::BUFFER_SIZE]};
+  size_t used = 0;
+  uint64_t remaining;  // Сколько ключей ещё должно быть записано
+  BinaryFormat::Checksum checksum;
+
+  template <class V>
+  void put(char *to, V v) {
+    v = BinaryFormat::littleEndian(v);
+    std::memcpy(to, &v, sizeof(V));
+  }
+  void flush() {
+    checksum.add(buffer.get(), used);
+    out.write(buffer.get(), used);
+    used = 0;
+  }
+
+ public:
+  BinaryWriter(std::ostream &out, uint64_t count, uint8_t flags) : out(out), remaining(count) {
+    char header[BinaryFormat::HEADER_SIZE];
+    std::memcpy(header, BinaryFormat::MAGIC, 4);
+    put(header + 4, BinaryFormat::VERSION);
+    header[6] = (char)BinaryFormat::typeTag<T>();
+    header[7] = (char)flags;
+    put(header + 8, count);
+    out.write(header, sizeof(header));
+  }
+  void write(const T &value) {
+    if (remaining == 0) throw std::logic_error("BinaryWriter: ключей больше, чем указано в заголовке");
+    remaining--;
+    if (used + sizeof(T) > BinaryFormat::BUFFER_SIZE) flush();
+    put(buffer.get() + used, value);
+    used += sizeof(T);
+  }
+  // Дописать оставшиеся ключи и контрольную сумму
+  void finish() {
+    if (remaining != 0) throw std::logic_error("BinaryWriter: ключей меньше, чем указано в заголовке");
+    flush();
+    char trailer[8];
+    put(trailer, checksum.value());
+    out.write(trailer, sizeof(trailer));
+    out.flush();
+    if (!out) throw std::runtime_error("BinaryWriter: ошибка записи");
+  }
+};
+
+// Буферизованное чтение ключей из двоичного формата
+// Заголовок проверяется в конструкторе, порядок ключей - при чтении, контрольная сумма - в finish().
+// Любое нарушение формата - исключение FormatError
+template <class T>
+class BinaryReader {
+  std::istream &in;
+  std::unique_ptr<char[]> buffer{new char[BinaryFormat::BUFFER_SIZE]};
+  size_t pos = 0, filled = 0;
+  uint64_t count;
+  uint64_t remaining;  // Сколько ключей ещё не прочитано
+  bool distinct;
+  bool first = true;
+  T previous{};
+  BinaryFormat::Checksum checksum;
+
+  template <class V>
+  static V get(const char *from) {
+    V v;
+    std::memcpy(&v, from, sizeof(V));
+    return BinaryFormat::littleEndian(v);
+  }
+  void readExactly(char *to, size_t size, const char *what) {
+    in.read(to, size);
+    if ((size_t)in.gcount() != size) throw FormatError(std::string("Двоичный формат: файл обрезан (") + what + ")");
+  }
+  // Следующий блок ключей: не больше BUFFER_SIZE байт и не дальше конца ключей
+  void refill() {
+    uint64_t bytes = std::min<uint64_t>(remaining * sizeof(T), BinaryFormat::BUFFER_SIZE);
+    readExactly(buffer.get(), bytes, "ключи");
+    checksum.add(buffer.get(), bytes);
+    pos = 0;
+    filled = bytes;
+  }
+
+ public:
+  // requireDistinct - ключи должны строго возрастать, даже если флаг DISTINCT не записан
+  explicit BinaryReader(std::istream &in, bool requireDistinct = false) : in(in) {
+    char header[BinaryFormat::HEADER_SIZE];
+    readExactly(header, sizeof(header), "заголовок");
+    if (std::memcmp(header, BinaryFormat::MAGIC, 4) != 0) throw FormatError("Двоичный формат: неверная сигнатура");
+    if (get<uint16_t>(header + 4) != BinaryFormat::VERSION)
+      throw FormatError("Двоичный формат: неподдерживаемая версия " + std::to_string(get<uint16_t>(header + 4)));
+    if ((uint8_t)header[6] != BinaryFormat::typeTag<T>()) throw FormatError("Двоичный формат: другой тип ключей");
+    distinct = requireDistinct || (header[7] & BinaryFormat::DISTINCT);
+    remaining = count = get<uint64_t>(header + 8);
+  }
+  uint64_t size() const {
+    return count;
+  }
+  // Следующий ключ
+  T read() {
+    if (remaining == 0) throw std::logic_error("BinaryReader: все ключи уже прочитаны");
+    if (pos == filled) refill();
+    T value = get<T>(buffer.get() + pos);
+    pos += sizeof(T);
+    remaining--;
+    if (!first && (value < previous || (distinct && !(previous < value))))
+      throw FormatError("Двоичный формат: ключи не упорядочены");
+    first = false;
+    previous = value;
+    return value;
+  }
+  // Проверить контрольную сумму после того, как прочитаны все ключи
+  void finish() {
+    char trailer[8];
+    readExactly(trailer, sizeof(trailer), "контрольная сумма");
+    if (get<uint64_t>(trailer) != checksum.value()) throw FormatError("Двоичный формат: неверная контрольная сумма");
+  }
+
+  // Ключи по порядку для построения дерева (BinaryTree::build): очередной ключ читается при ++
+  struct Iterator {
+    BinaryReader *reader;
+    T value{};
+    explicit Iterator(BinaryReader *reader) : reader(reader) {
+      if (reader->remaining > 0) value = reader->read();
+    }
+    const T &operator*() const {
+      return value;
+    }
+    Iterator &operator++() {
+      if (reader->remaining > 0) value = reader->read();
+      return *this;
+    }
+  };
+  Iterator begin() {
+    return Iterator(this);
+  }
+};
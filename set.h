@@ -8,62 +8,179 @@
 
 #include "binarytree.h"
 #include "common.hpp"
+#include "text.h"
 
 using namespace std;
 
 // Множество
-template <typename T>
+// Monoid - агрегат, который поддерживается для всего множества и любого отрезка значений (см. aggregate.h)
+template <typename T, typename Monoid = NoAggregate<T>>
 class Set {
-  BinaryTree<T> tree;  // Для реализации используется бинарное дерево поиска
+  BinaryTree<T, Monoid> tree;  // Для реализации используется бинарное дерево поиска
+  // Сортируем (если ещё не отсортировано), убираем повторы и строим сбалансированное дерево за O(n)
+  void build(vector<T> values) {
+    if (!is_sorted(values.begin(), values.end())) sort(values.begin(), values.end());
+    values.erase(unique(values.begin(), values.end()), values.end());
+    tree.buildFromSorted(values.begin(), (int)values.size());
+  }
+  explicit Set(BinaryTree<T, Monoid> &&tree) : tree(std::move(tree)) {}
+  // С какого суммарного размера операции над множествами выполняются параллельно
+  // Только для множеств близкого размера: параллельная версия копирует оба дерева за O(n + m),
+  // а для маленького множества поиск его элементов в большом - O(m log(n/m))
+  static constexpr int PARALLEL_SIZE = 1 << 16;
+  bool parallel(const Set &s) const {
+    return size() + s.size() >= PARALLEL_SIZE && ThreadPool::instance().size() > 0 &&
+           !muchSmaller(size(), s.size()) && !muchSmaller(s.size(), size());
+  }
+  // Множество из отсортированных различных значений
+  static Set fromSorted(const vector<T> &values) {
+    Set res;
+    res.tree.buildFromSorted(values.begin(), (int)values.size());
+    return res;
+  }
+  template <typename, typename>
+  friend class Set;  // Для map во множество с другим типом элементов
+  // map во множество Set<U, M>: результаты сортируются, повторы убираются
+  template <class U, class M, class F>
+  Set<U, M> mapTo(F &f) const {
+    vector<U> values;
+    values.reserve(size());
+    for (const T &x : tree) values.push_back(f(x));
+    Set<U, M> res;
+    res.build(std::move(values));
+    return res;
+  }
+  void print(TextWriter &out) const {
+    for (const T &x : tree) {
+      out.value(x);
+      out.put(' ');  // Последний пробел не попадёт в вывод
+    }
+  }
+  // Выгоднее ли обойти m элементов с поиском в n, чем слить оба множества за O(n + m)
+  static bool muchSmaller(int m, int n) {
+    int log = 1;
+    while (log < 31 && (1 << log) < n) log++;
+    return (long long)m * log < n;
+  }
+  // Элементы first, которые есть (keep == true) или которых нет (keep == false) в second
+  // Поиск в second продолжается с предыдущей позиции: O(m log(n/m))
+  static vector<T> filterBy(const Set &first, const Set &second, bool keep) {
+    vector<T> res;
+    auto it = second.tree.begin();
+    auto end = second.tree.end();
+    for (const T &x : first.tree) {
+      it.seek(x);
+      bool found = it != end && !(x < *it);
+      if (found == keep) res.push_back(x);
+    }
+    return res;
+  }
  public:
   // == Конструкторы - инициализация ==
   Set() = default;  // Пустое множество
+  // Копирование - глубокая копия дерева за O(n), перемещение - за O(1)
+  Set(const Set &) = default;
+  Set(Set &&) noexcept = default;
+  Set &operator=(const Set &) = default;
+  Set &operator=(Set &&) noexcept = default;
   // В STL е
   // Инициализация из std::set
   explicit Set(std::set<T> set) : tree(set) {}
   // И из списка значений при инициализации, например: Set<int> s {1,3}
-  Set(initializer_list<T> list) : tree(list) {}
+  Set(initializer_list<T> list) {
+    build(vector<T>(list));
+  }
   // Инициализация из строки
+  // Числа разбираются std::from_chars прямо в буфер, из которого дерево строится целиком
   explicit Set(const char *str) {
-    istringstream in(str);
-    T value;  // Очередное значение из строки
-    while (in >> value) tree.insert(value);
-  }
-  explicit Set(const string &str) {
-    istringstream in(str);
-    T value;
-    while (in >> value) tree.insert(value);
+    vector<T> values;
+    parseValues(str, values);
+    build(std::move(values));
   }
+  explicit Set(const string &str) : Set(str.c_str()) {}
   // map, reduce, where
+  // Функции можно передавать любые вызываемые объекты (в т.ч. лямбды с состоянием)
   // map - применение функции к каждому элементу множества
-  Set<T> map(T f(T)) {
-    Set<T> res;  // Создаётся новое множество
-    for (T x : tree) {
-      res.insert(f(x));
-    }
-    return res;
+  Set map(T f(T)) const {
+    return mapTo<T, Monoid>(f);  // Создаётся новое множество
+  }
+  // Результат f может иметь другой тип: получаем Set<U>
+  template <class F, class U = std::decay_t<std::invoke_result_t<F &, const T &>>>
+  Set<U> map(F f) const {
+    return mapTo<U, NoAggregate<U>>(f);
+  }
+  // map для строго возрастающей f (x < y => f(x) < f(y)), как BinaryTree::mapMonotone:
+  // образы различны, поэтому дерево копируется за O(n) без сортировки и удаления повторов
+  template <class F, class U = std::decay_t<std::invoke_result_t<F &, const T &>>>
+  Set<U> mapMonotone(F f) const {
+    return Set<U>(tree.mapMonotone(f));
   }
   // where фильтрует значения из списка l с помощью функции-фильтра h
-  Set<T> where(bool h(T)) {
-    Set<T> res;
-    for (T x : tree)
-      if (h(x)) {
-        res.insert(x);
-      }
-    return res;
+  Set where(bool h(T)) const {
+    return Set(tree.where(h));
+  }
+  template <class H>
+  Set where(H h) const {
+    return Set(tree.where(h));
   }
   // reduce - применяем к каждой паре значений пока не получим одно значение
-  T reduce(T f(T, T)) {
+  T reduce(T f(T, T)) const {
+    return tree.reduce(f);
+  }
+  template <class F>
+  T reduce(F f) const {
     return tree.reduce(f);
   }
+  // Параллельные map, where, reduce на пуле потоков
+  template <class F>
+  Set parallelMap(F f, ThreadPool &threads = ThreadPool::instance()) const {
+    vector<T> values = tree.mapSorted(f, threads);
+    values.erase(unique(values.begin(), values.end()), values.end());
+    return fromSorted(values);
+  }
+  template <class H>
+  Set parallelWhere(H h, ThreadPool &threads = ThreadPool::instance()) const {
+    return fromSorted(tree.whereSorted(h, threads));
+  }
+  template <class F>
+  T parallelReduce(F f, ThreadPool &threads = ThreadPool::instance()) const {
+    return tree.parallelReduce(f, threads);
+  }
+  // Агрегат всех элементов за O(1)
+  typename Monoid::Value reduce() const {
+    return tree.reduce();
+  }
+  // Агрегат элементов из отрезка [lo, hi] за O(log n)
+  typename Monoid::Value reduceRange(const T &lo, const T &hi) const {
+    return tree.reduceRange(lo, hi);
+  }
   // Размер множества
   int size() const {
     return tree.getSize();
   }
-  // Добавить значение в множество
-  void insert(const T &value) {
-    if (tree.find(value)) return;  // Если такое значение уже есть => не добавляем
-    tree.insert(value);            // Если нет значения, то добавляем
+  // k-й по возрастанию элемент (k от 0) за O(log n)
+  T select(int k) const {
+    return tree.select(k)->value;
+  }
+  // Позиция элемента по возрастанию (от 0), -1 если его нет
+  int rank(const T &value) const {
+    return tree.rank(value);
+  }
+  // Количество элементов меньше value
+  int countLess(const T &value) const {
+    return tree.countLess(value);
+  }
+  // Добавить значение в множество: false, если такое значение уже есть
+  bool insert(const T &value) {
+    return tree.insertUnique(value).second;  // Поиск и вставка за один спуск
+  }
+  bool insert(T &&value) {
+    return tree.insertUnique(std::move(value)).second;  // Значение перемещается в узел
+  }
+  // Значение создаётся из параметров конструктора T и перемещается в узел, если его ещё нет
+  template <class... Args>
+  bool emplace(Args &&...args) {
+    return insert(T(std::forward<Args>(args)...));
   }
   // Поиск значения в множестве
   bool find(const T &value) const {
@@ -74,70 +191,120 @@ class Set {
     tree.remove(value);
   }
   // Объединение множеств
-  Set<T> setUnion(Set<T> &s) {
-    Set<T> res;  // Итоговое множество
-    for (T x : tree) res.insert(x);  // Берём "наше" дерево поиска и добавляем все элементы из него
-    for (T x : s) res.insert(x);  // Берём второе множество и добавляем все элементы из него
-    // За счёт того что повторно элементы не добавляются
-    return res;
+  // Оба дерева обходим по возрастанию одновременно (слияние) и строим результат за O(n + m)
+  // На больших множествах близкого размера при наличии свободных ядер - параллельная рекурсия на split/join
+  Set setUnion(const Set &s) const {
+    if (parallel(s)) return Set(BinaryTree<T, Monoid>::setUnion(tree, s.tree));
+    vector<T> res;
+    res.reserve(size() + s.size());
+    auto a = tree.begin(), aEnd = tree.end();
+    auto b = s.tree.begin(), bEnd = s.tree.end();
+    while (a != aEnd && b != bEnd) {
+      if (*a < *b) {
+        res.push_back(*a++);
+      } else if (*b < *a) {
+        res.push_back(*b++);
+      } else {  // Общий элемент берём один раз
+        res.push_back(*a++);
+        ++b;
+      }
+    }
+    for (; a != aEnd; ++a) res.push_back(*a);
+    for (; b != bEnd; ++b) res.push_back(*b);
+    return fromSorted(res);
   }
   // Пересечение множеств
-  Set<T> intersection(Set<T> &s) {
-    Set<T> res;
-    for (T x : tree)  // Пробегаем по всем элементам нашего множества
-      if (s.find(x))  // Если элемент содержится и в другом множестве
-        res.insert(x);
-    return res;
+  // Слиянием за O(n + m) или, если одно множество намного меньше, поиском его элементов в другом
+  Set intersection(const Set &s) const {
+    if (muchSmaller(size(), s.size())) return fromSorted(filterBy(*this, s, true));
+    if (muchSmaller(s.size(), size())) return fromSorted(filterBy(s, *this, true));
+    if (parallel(s)) return Set(BinaryTree<T, Monoid>::intersection(tree, s.tree));
+    vector<T> res;
+    auto a = tree.begin(), aEnd = tree.end();
+    auto b = s.tree.begin(), bEnd = s.tree.end();
+    while (a != aEnd && b != bEnd) {
+      if (*a < *b) {
+        ++a;
+      } else if (*b < *a) {
+        ++b;
+      } else {  // Элемент содержится в обоих множествах
+        res.push_back(*a++);
+        ++b;
+      }
+    }
+    return fromSorted(res);
   }
   // Вычитание множеств: в результат войдут все "наши" элементы которых нет во втором множестве
-  Set<T> difference(Set<T> &s) {
-    Set<T> res;
-    for (T x : tree)   // Пробегаем по всем элементам нашего множества
-      if (!s.find(x))  // Если элемент не содержится в другом множестве
-        res.insert(x);
-    return res;
+  Set difference(const Set &s) const {
+    if (muchSmaller(size(), s.size())) return fromSorted(filterBy(*this, s, false));
+    if (parallel(s)) return Set(BinaryTree<T, Monoid>::difference(tree, s.tree));
+    vector<T> res;
+    auto a = tree.begin(), aEnd = tree.end();
+    auto b = s.tree.begin(), bEnd = s.tree.end();
+    while (a != aEnd && b != bEnd) {
+      if (*a < *b) {  // Элемента нет во втором множестве
+        res.push_back(*a++);
+      } else if (*b < *a) {
+        ++b;
+      } else {
+        ++a;
+        ++b;
+      }
+    }
+    for (; a != aEnd; ++a) res.push_back(*a);
+    return fromSorted(res);
   }
   // Является ли текущее множество подмножеством другого?
-  bool subSet(const Set<T> &set) const {
+  bool subSet(const Set &set) const {
     for (T x : tree) {  // Перебираем все элементы нашего множества
       if (!set.find(x)) return false;  // Если какой-то элемент не найден => не является подмножеством
     }
     return true;  // Если все найдены, то является подмножеством
   }
   // Проверка на равенство (двух множеств): равны ли множества?
-  bool equal(const Set<T> &set) const {
+  bool equal(const Set &set) const {
     return this->subSet(set) && set.subSet(*this);
   }
-  // Сохраним в строку
+  // Сохраним в строку: обход дерева уже идёт по возрастанию, числа печатаются std::to_chars
   string toString() const {
-    // Сохраним элементы как вектор
-    vector<T> elements;
-    for (T x : tree) elements.push_back(x);
-    // Отсортируем вектор по неубыванию
-    sort(elements.begin(), elements.end());
-    // Напечатаем отсортированные элементы в строку
-    stringstream ss;
-    for (T x : elements) ss << x << " ";
-    return trim_copy(ss.str());
+    TextWriter out;
+    print(out);
+    return out.take();
+  }
+  // То же сразу в поток, блоками - без строки со всем множеством
+  void printTo(std::ostream &os) const {
+    TextWriter out(os);
+    print(out);
+  }
+  // Запись в двоичном формате и чтение из него за O(n), без промежуточного текста (см. serialization.h)
+  void save(std::ostream &out) const {
+    tree.save(out, BinaryFormat::DISTINCT);
+  }
+  void load(std::istream &in) {
+    tree.load(in, true);
+  }
+  // Образ для отображения в память: открывается как MappedTree<T> (см. mappedtree.h)
+  void saveImage(std::ostream &out) const {
+    tree.saveImage(out, BinaryFormat::DISTINCT);
   }
   void printAsTree() {
     tree.printAsTree();
   }
   struct Iterator {
-    using iterator_category = forward_iterator_tag;
+    using iterator_category = bidirectional_iterator_tag;
     using difference_type = ptrdiff_t;
     using value_type = T;
     using pointer = T *;
     using reference = T &;
 
-    typename BinaryTree<T>::Iterator iterator;
+    typename BinaryTree<T, Monoid>::Iterator iterator;
     // Используем итератор для вложенной структуры
-    explicit Iterator(typename BinaryTree<T>::Iterator iterator) : iterator(iterator) {}
+    explicit Iterator(typename BinaryTree<T, Monoid>::Iterator iterator) : iterator(iterator) {}
     reference operator*() const {
       return *iterator;
     }
-    pointer operator->() {
-      return iterator;
+    pointer operator->() const {
+      return iterator.operator->();
     }
     Iterator &operator++() {
       ++iterator;
@@ -148,6 +315,15 @@ class Set {
       ++(*this);
       return tmp;
     }
+    Iterator &operator--() {
+      --iterator;
+      return *this;
+    }
+    Iterator operator--(int) {
+      Iterator tmp = *this;
+      --(*this);
+      return tmp;
+    }
     friend bool operator==(const Iterator &a, const Iterator &b) {
       return a.iterator == b.iterator;
     };
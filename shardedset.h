@@ -0,0 +1,297 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "binarytree.h"
+#include "common.hpp"
+#include "text.h"
+
+// Множество, разбитое по диапазонам ключей на шарды
+// Каждый шард - своё АВЛ-дерево (BinaryTree) со своим пулом узлов и своей блокировкой, поэтому
+// потоки, меняющие разные диапазоны ключей, не мешают друг другу. Шард выбирается двоичным
+// поиском по небольшому отсортированному массиву границ (splitters).
+// Перекошенные шарды перебалансируются: слишком большой делится пополам по медиане,
+// слишком маленький сливается с соседом
+template <typename T>
+class ShardedSet {
+  struct alignas(64) Shard {  // Отдельная кэш-линия: блокировки соседних шардов не делят её
+    mutable std::shared_mutex m;
+    BinaryTree<T> tree;
+  };
+
+  // Разбиение на шарды: читается всеми операциями, меняется только при перебалансировке
+  mutable std::shared_mutex layout;
+  std::vector<std::unique_ptr<Shard>> shards;
+  std::vector<T> splitters;  // В шарде i значения из [splitters[i - 1], splitters[i])
+  std::atomic<int> count{0};
+  int target;  // Желаемое количество шардов
+
+  static constexpr int MIN_SHARD = 1024;  // Меньшие шарды не делятся
+
+  // Номер шарда для значения
+  int shardOf(const T &value) const {
+    return (int)(std::upper_bound(splitters.begin(), splitters.end(), value) - splitters.begin());
+  }
+  // Размер, после которого шард делится: вдвое больше среднего при target шардах
+  int splitLimit() const {
+    return std::max(MIN_SHARD, 2 * count.load(std::memory_order_relaxed) / target);
+  }
+  static std::vector<T> values(const Shard &s) {
+    std::vector<T> res;
+    res.reserve(s.tree.getSize());
+    for (const T &x : s.tree) res.push_back(x);
+    return res;
+  }
+  static std::unique_ptr<Shard> makeShard(typename std::vector<T>::const_iterator first, int size) {
+    auto s = std::make_unique<Shard>();
+    s->tree.buildFromSorted(first, size);  // Новое дерево - в собственном пуле
+    return s;
+  }
+  // Деление шарда i по медиане на два, вызывается под исключительной блокировкой разбиения
+  void splitShard(int i) {
+    std::vector<T> all = values(*shards[i]);
+    int half = (int)all.size() / 2;
+    shards[i] = makeShard(all.begin(), half);
+    shards.insert(shards.begin() + i + 1, makeShard(all.begin() + half, (int)all.size() - half));
+    splitters.insert(splitters.begin() + i, all[half]);
+  }
+  // Слияние шардов i и i + 1; если результат слишком велик - делим заново по общей медиане
+  void mergeShards(int i, int limit) {
+    std::vector<T> all = values(*shards[i]);
+    for (const T &x : shards[i + 1]->tree) all.push_back(x);
+    shards[i] = makeShard(all.begin(), (int)all.size());
+    shards.erase(shards.begin() + i + 1);
+    splitters.erase(splitters.begin() + i);
+    if ((int)all.size() > limit) splitShard(i);
+  }
+  int sizeOf(int i) const {
+    return shards[i]->tree.getSize();
+  }
+  // Различные отсортированные значения раскладываются по шардам поровну
+  void assign(std::vector<T> all) {
+    std::sort(all.begin(), all.end());
+    all.erase(std::unique(all.begin(), all.end()), all.end());
+    int n = (int)all.size();
+    int k = std::max(1, std::min(target, n / MIN_SHARD));
+    shards.clear();
+    splitters.clear();
+    for (int i = 0; i < k; i++) {
+      int from = (int)((long long)n * i / k), to = (int)((long long)n * (i + 1) / k);
+      if (i > 0) splitters.push_back(all[from]);
+      shards.push_back(makeShard(all.begin() + from, to - from));
+    }
+    count = n;
+  }
+
+ public:
+  // shards - желаемое количество шардов, по умолчанию по одному на ядро
+  explicit ShardedSet(int shards = (int)std::max(1u, std::thread::hardware_concurrency()))
+      : target(std::max(1, shards)) {
+    this->shards.push_back(std::make_unique<Shard>());
+  }
+  ShardedSet(std::initializer_list<T> list, int shards = (int)std::max(1u, std::thread::hardware_concurrency()))
+      : target(std::max(1, shards)) {
+    assign(std::vector<T>(list));
+  }
+  // Множество из произвольных значений: повторы убираются, шарды получаются одинакового размера
+  template <class It>
+  ShardedSet(It first, It last, int shards = (int)std::max(1u, std::thread::hardware_concurrency()))
+      : target(std::max(1, shards)) {
+    assign(std::vector<T>(first, last));
+  }
+  ShardedSet(const ShardedSet &) = delete;
+  ShardedSet &operator=(const ShardedSet &) = delete;
+
+  int size() const {
+    return count.load(std::memory_order_relaxed);
+  }
+  // Текущее количество шардов (может отличаться от желаемого, пока множество мало)
+  int shardCount() const {
+    std::shared_lock<std::shared_mutex> route(layout);
+    return (int)shards.size();
+  }
+  // Размеры шардов по возрастанию ключей (для тестов и замеров)
+  std::vector<int> shardSizes() const {
+    std::shared_lock<std::shared_mutex> route(layout);
+    std::vector<int> res;
+    for (size_t i = 0; i < shards.size(); i++) {
+      std::shared_lock<std::shared_mutex> lock(shards[i]->m);
+      res.push_back(sizeOf((int)i));
+    }
+    return res;
+  }
+  bool find(const T &value) const {
+    std::shared_lock<std::shared_mutex> route(layout);
+    const Shard &s = *shards[shardOf(value)];
+    std::shared_lock<std::shared_mutex> lock(s.m);
+    return s.tree.find(value) != nullptr;
+  }
+  // Добавить значение: false, если такое значение уже есть
+  bool insert(const T &value) {
+    bool inserted;
+    int shardSize;
+    {
+      std::shared_lock<std::shared_mutex> route(layout);
+      Shard &s = *shards[shardOf(value)];
+      std::lock_guard<std::shared_mutex> lock(s.m);
+      inserted = s.tree.insertUnique(value).second;
+      shardSize = s.tree.getSize();
+    }
+    if (!inserted) return false;
+    count.fetch_add(1, std::memory_order_relaxed);
+    if (shardSize > splitLimit()) rebalance();
+    return true;
+  }
+  // Удалить значение: false, если его не было
+  bool erase(const T &value) {
+    int before, shardSize, shardTotal;
+    {
+      std::shared_lock<std::shared_mutex> route(layout);
+      Shard &s = *shards[shardOf(value)];
+      std::lock_guard<std::shared_mutex> lock(s.m);
+      before = s.tree.getSize();
+      s.tree.remove(value);
+      shardSize = s.tree.getSize();
+      shardTotal = (int)shards.size();
+    }
+    if (shardSize == before) return false;
+    count.fetch_sub(1, std::memory_order_relaxed);
+    if (shardTotal > 1 && shardSize * 8 < splitLimit()) rebalance();  // Шард опустел - сливаем с соседом
+    return true;
+  }
+  // Перебалансировка: большие шарды делятся, маленькие сливаются с меньшим из соседей,
+  // лишние (сверх желаемого количества) - сливаются попарно, начиная с самой лёгкой пары
+  // Останавливает все операции на время O(размера затронутых шардов)
+  void rebalance() {
+    std::unique_lock<std::shared_mutex> route(layout);
+    int limit = splitLimit();
+    for (int i = 0; i < (int)shards.size(); i++) {
+      while (sizeOf(i) > limit) splitShard(i);
+    }
+    for (int i = 0; i < (int)shards.size() && shards.size() > 1;) {
+      if (sizeOf(i) * 8 >= limit) {
+        i++;
+        continue;
+      }
+      bool withLeft = i > 0 && (i + 1 == (int)shards.size() || sizeOf(i - 1) < sizeOf(i + 1));
+      int first = withLeft ? i - 1 : i;
+      mergeShards(first, limit);
+      i = first;  // Слитый шард мог остаться маленьким
+    }
+    while ((int)shards.size() > target) {
+      int best = 0;
+      for (int i = 1; i + 1 < (int)shards.size(); i++) {
+        if (sizeOf(i) + sizeOf(i + 1) < sizeOf(best) + sizeOf(best + 1)) best = i;
+      }
+      if (sizeOf(best) + sizeOf(best + 1) > limit) break;  // Слияние тут же пришлось бы отменить
+      mergeShards(best, limit);
+    }
+  }
+  // Обход всех значений по возрастанию; каждый шард на время его обхода блокируется для чтения
+  template <class F>
+  void forEach(F f) const {
+    std::shared_lock<std::shared_mutex> route(layout);
+    for (const auto &s : shards) {
+      std::shared_lock<std::shared_mutex> lock(s->m);
+      for (const T &x : s->tree) f(x);
+    }
+  }
+  std::vector<T> toVector() const {
+    std::vector<T> res;
+    res.reserve(size());
+    forEach([&](const T &x) { res.push_back(x); });
+    return res;
+  }
+  string toString() const {
+    TextWriter out;
+    forEach([&](const T &x) {
+      out.value(x);
+      out.put(' ');
+    });
+    return out.take();
+  }
+  // Проверка инвариантов (для тестов, без одновременных изменений)
+  void check() const {
+    assert(splitters.size() + 1 == shards.size());
+    assert(std::is_sorted(splitters.begin(), splitters.end()));
+    int total = 0;
+    for (int i = 0; i < (int)shards.size(); i++) {
+      shards[i]->tree.check();
+      for (const T &x : shards[i]->tree) {
+        assert(i == 0 || !(x < splitters[i - 1]));
+        assert(i + 1 == (int)shards.size() || x < splitters[i]);
+      }
+      total += sizeOf(i);
+    }
+    assert(total == size());
+  }
+
+  // Итератор по возрастанию: шарды упорядочены по диапазонам, поэтому слияние - это переход
+  // от конца одного шарда к началу следующего. Не блокирует шарды - только без одновременных изменений
+  struct Iterator {
+    using iterator_category = std::forward_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = T;
+    using pointer = const T *;
+    using reference = const T &;
+
+    Iterator(const ShardedSet *set, int shard) : set(set), shard(shard), it(nullptr, true) {
+      skipEmpty();
+    }
+    reference operator*() const {
+      return *it;
+    }
+    pointer operator->() const {
+      return &*it;
+    }
+    Iterator &operator++() {
+      ++it;
+      if (--left == 0) {
+        shard++;
+        skipEmpty();
+      }
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator tmp = *this;
+      ++(*this);
+      return tmp;
+    }
+    friend bool operator==(const Iterator &a, const Iterator &b) {
+      return a.shard == b.shard && a.left == b.left;  // В одном шарде позицию задаёт остаток
+    }
+    friend bool operator!=(const Iterator &a, const Iterator &b) {
+      return !(a == b);
+    }
+
+   private:
+    const ShardedSet *set;
+    int shard;
+    typename BinaryTree<T>::Iterator it;
+    int left = 0;  // Сколько значений текущего шарда ещё не пройдено
+
+    // Перейти к первому непустому шарду, начиная с текущего
+    void skipEmpty() {
+      while (shard < (int)set->shards.size() && set->sizeOf(shard) == 0) shard++;
+      if (shard == (int)set->shards.size()) return;
+      it = set->shards[shard]->tree.begin();
+      left = set->sizeOf(shard);
+    }
+  };
+  Iterator begin() const {
+    return Iterator(this, 0);
+  }
+  Iterator end() const {
+    return Iterator(this, (int)shards.size());
+  }
+};
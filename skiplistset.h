@@ -0,0 +1,391 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "common.hpp"
+#include "epoch.h"
+#include "text.h"
+
+// Множество на списке с пропусками (skip list) без блокировок
+// Интерфейс как у Set<T> (set.h), но вставлять, удалять и искать можно из многих потоков
+// одновременно: перестройки всего дерева нет, каждое изменение - несколько CAS соседних ссылок.
+// Удаление: узел помечается в ссылках next (младший бит указателя) сверху вниз, пометка
+// на уровне 0 - момент удаления; помеченные узлы вырезаются при любом проходе мимо них.
+// Память вырезанных узлов освобождается по эпохам (epoch.h).
+// Из интерфейса Set сознательно нет того, что требует дерева или одного владельца:
+// select, rank, countLess, reduce() и reduceRange по моноиду, mapMonotone, parallelMap/Where/Reduce,
+// emplace, save/load/saveImage, printTo и printAsTree
+template <typename T>
+class SkipListSet {
+  static constexpr int MAX_LEVEL = 24;  // Хватит на ~2^24 * 4 элементов при вероятности 1/4
+  using Link = uintptr_t;               // Указатель на узел и пометка удаления в младшем бите
+
+  struct Node {
+    const T key;
+    const int levels;                  // На скольких уровнях узел есть
+    std::atomic<Link> *next;           // Ссылки на следующие узлы по уровням
+    std::atomic<int> owners{2};        // Вставляющий и удаляющий: последний отдаёт узел на освобождение
+    Node(const T &key, int levels) : key(key), levels(levels), next(new std::atomic<Link>[levels]) {
+      for (int i = 0; i < levels; i++) next[i].store(0, std::memory_order_relaxed);
+    }
+    ~Node() {
+      delete[] next;
+    }
+  };
+  static Node *pointer(Link link) {
+    return reinterpret_cast<Node *>(link & ~Link(1));
+  }
+  static bool marked(Link link) {
+    return link & 1;
+  }
+  static Link linkTo(Node *n, bool mark = false) {
+    return reinterpret_cast<Link>(n) | Link(mark);
+  }
+
+  Node *head;                  // Заголовок: ключ не используется, есть на всех уровнях
+  std::atomic<int> count{0};   // Количество элементов
+
+  static bool same(const T &a, const T &b) {
+    return !(a < b) && !(b < a);
+  }
+  // Случайная высота узла: уровень l с вероятностью 4^-l
+  static int randomLevel() {
+    static thread_local uint64_t state = 0x9E3779B97F4A7C15ull ^ reinterpret_cast<uintptr_t>(&state);
+    state ^= state << 13;  // xorshift
+    state ^= state >> 7;
+    state ^= state << 17;
+    int level = 1;
+    for (uint64_t bits = state; level < MAX_LEVEL && (bits & 3) == 0; bits >>= 2) level++;
+    return level;
+  }
+  // Поиск места для key: preds[l] - последний узел < key на уровне l, succs[l] - следующий за ним
+  // По дороге вырезаются помеченные узлы. true - непомеченный узел с key есть (succs[0])
+  bool locate(const T &key, Node **preds, Node **succs) const {
+  retry:
+    Node *pred = head;
+    for (int level = MAX_LEVEL - 1; level >= 0; level--) {
+      Node *curr = pointer(pred->next[level].load());
+      while (curr) {
+        Link succ = curr->next[level].load();
+        while (marked(succ)) {  // curr удалён: вырезаем его на этом уровне
+          Link expected = linkTo(curr);
+          if (!pred->next[level].compare_exchange_strong(expected, linkTo(pointer(succ)))) goto retry;
+          curr = pointer(succ);
+          if (curr == nullptr) break;
+          succ = curr->next[level].load();
+        }
+        if (curr == nullptr || !(curr->key < key)) break;
+        pred = curr;
+        curr = pointer(succ);
+      }
+      preds[level] = pred;
+      succs[level] = curr;
+    }
+    return succs[0] && same(succs[0]->key, key);
+  }
+  // Отпустить узел: последний из вставляющего и удаляющего откладывает его освобождение
+  void release(Node *n) {
+    if (n->owners.fetch_sub(1) == 1) EpochManager::instance().retire(n);
+  }
+  // Однопоточное заполнение пустого списка упорядоченными различными значениями за O(n)
+  template <class It>
+  void appendSorted(It first, It last) {
+    Node *tails[MAX_LEVEL];
+    std::fill(tails, tails + MAX_LEVEL, head);
+    for (; first != last; ++first) {
+      Node *n = new Node(*first, randomLevel());
+      n->owners.store(1, std::memory_order_relaxed);  // Вставка уже завершена
+      for (int l = 0; l < n->levels; l++) {
+        tails[l]->next[l].store(linkTo(n), std::memory_order_relaxed);
+        tails[l] = n;
+      }
+      count.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  static SkipListSet fromSorted(const std::vector<T> &values) {
+    SkipListSet res;
+    res.appendSorted(values.begin(), values.end());
+    return res;
+  }
+  // Удалить все узлы (без одновременной работы других потоков)
+  void destroyAll() {
+    for (Node *n = pointer(head->next[0].load()); n;) {
+      Node *next = pointer(n->next[0].load());
+      delete n;
+      n = next;
+    }
+    for (int l = 0; l < MAX_LEVEL; l++) head->next[l].store(0);
+    count = 0;
+  }
+
+ public:
+  SkipListSet() : head(new Node(T(), MAX_LEVEL)) {}
+  SkipListSet(std::initializer_list<T> list) : SkipListSet() {
+    std::vector<T> values(list);
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    appendSorted(values.begin(), values.end());
+  }
+  // Инициализация из строки, например: "1 3 2"
+  explicit SkipListSet(const char *str) : SkipListSet() {
+    std::vector<T> values;
+    parseValues(str, values);
+    if (!std::is_sorted(values.begin(), values.end())) std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    appendSorted(values.begin(), values.end());
+  }
+  explicit SkipListSet(const std::string &str) : SkipListSet(str.c_str()) {}
+  // Копия текущего содержимого за O(n)
+  SkipListSet(const SkipListSet &other) : SkipListSet() {
+    EpochGuard guard;
+    appendSorted(other.begin(), other.end());
+  }
+  SkipListSet(SkipListSet &&other) noexcept : head(other.head), count(other.count.load()) {
+    other.head = new Node(T(), MAX_LEVEL);
+    other.count = 0;
+  }
+  SkipListSet &operator=(SkipListSet other) {
+    std::swap(head, other.head);
+    count = other.count.exchange(count.load());
+    return *this;
+  }
+  ~SkipListSet() {
+    destroyAll();
+    delete head;
+  }
+
+  // Количество элементов
+  int size() const {
+    return count.load(std::memory_order_relaxed);
+  }
+  // Поиск без изменений списка: помеченные узлы просто пропускаем
+  bool find(const T &value) const {
+    EpochGuard guard;
+    Node *pred = head;
+    Node *curr = nullptr;
+    for (int level = MAX_LEVEL - 1; level >= 0; level--) {
+      curr = pointer(pred->next[level].load(std::memory_order_acquire));
+      while (curr) {
+        Link succ = curr->next[level].load(std::memory_order_acquire);
+        if (marked(succ)) {  // Удалённый узел
+          curr = pointer(succ);
+          continue;
+        }
+        if (!(curr->key < value)) break;
+        pred = curr;
+        curr = pointer(succ);
+      }
+    }
+    return curr && same(curr->key, value) && !marked(curr->next[0].load(std::memory_order_acquire));
+  }
+  // Добавить значение: false, если такое уже есть
+  bool insert(const T &value) {
+    EpochGuard guard;
+    Node *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+    Node *n = nullptr;
+    while (true) {
+      if (locate(value, preds, succs)) {
+        delete n;  // Узел никому не был виден
+        return false;
+      }
+      if (n == nullptr) n = new Node(value, randomLevel());
+      for (int l = 0; l < n->levels; l++) n->next[l].store(linkTo(succs[l]), std::memory_order_relaxed);
+      Link expected = linkTo(succs[0]);
+      if (preds[0]->next[0].compare_exchange_strong(expected, linkTo(n))) break;  // Момент вставки
+    }
+    count++;
+    // Подвешиваем узел на верхних уровнях; если его уже удаляют - прекращаем
+    for (int l = 1; l < n->levels; l++) {
+      while (true) {
+        Link old = n->next[l].load();
+        if (marked(old)) break;
+        if (pointer(old) != succs[l] && !n->next[l].compare_exchange_strong(old, linkTo(succs[l]))) continue;
+        Link expected = linkTo(succs[l]);
+        if (preds[l]->next[l].compare_exchange_strong(expected, linkTo(n))) break;
+        locate(value, preds, succs);  // Соседи изменились
+        if (succs[0] != n) break;     // Узел уже удалили и вырезали
+      }
+      if (marked(n->next[l].load())) break;
+    }
+    // Если узел удалили, пока мы его подвешивали, он мог остаться на верхних уровнях - вырезаем
+    if (marked(n->next[0].load())) locate(value, preds, succs);
+    release(n);
+    return true;
+  }
+  // Удалить значение: false, если его нет.
+  // В отличие от Set::erase (void) возвращает результат: при одновременных удалениях только так
+  // можно узнать, какой из потоков удалил значение (как insert и ShardedSet::erase)
+  bool erase(const T &value) {
+    EpochGuard guard;
+    Node *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+    if (!locate(value, preds, succs)) return false;
+    Node *n = succs[0];
+    for (int l = n->levels - 1; l >= 1; l--) {  // Помечаем верхние уровни
+      Link link = n->next[l].load();
+      while (!marked(link) && !n->next[l].compare_exchange_weak(link, link | 1)) {
+      }
+    }
+    Link link = n->next[0].load();
+    while (true) {  // Пометка на уровне 0 - удаление; кто пометил первым, тот и удалил
+      if (marked(link)) return false;
+      if (n->next[0].compare_exchange_weak(link, link | 1)) break;
+    }
+    count--;
+    locate(value, preds, succs);  // Вырезаем узел со всех уровней
+    release(n);
+    return true;
+  }
+
+  // Итератор по возрастанию, безопасный при одновременных изменениях:
+  // пока он не дошёл до конца, эпоха закреплена и пройденные узлы не освобождаются
+  // (поэтому итератор нельзя передавать в другой поток).
+  // Значения, которые были в множестве весь обход, будут пройдены ровно один раз
+  struct Iterator {
+    using iterator_category = std::forward_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = T;
+    using pointer = const T *;
+    using reference = const T &;
+
+    Iterator() = default;
+    explicit Iterator(Node *n) : n(n) {
+      if (n) EpochManager::instance().pin();
+      skipDeleted();
+    }
+    // Копия указывает на тот же узел, даже если его уже удалили: закрепляем эпоху, но не сдвигаемся
+    Iterator(const Iterator &other) : n(other.n) {
+      if (n) EpochManager::instance().pin();
+    }
+    Iterator &operator=(const Iterator &other) {
+      if (other.n) EpochManager::instance().pin();
+      if (n) EpochManager::instance().unpin();
+      n = other.n;
+      return *this;
+    }
+    ~Iterator() {
+      if (n) EpochManager::instance().unpin();
+    }
+    reference operator*() const {
+      return n->key;
+    }
+    pointer operator->() const {
+      return &n->key;
+    }
+    Iterator &operator++() {
+      move(SkipListSet::pointer(n->next[0].load(std::memory_order_acquire)));
+      skipDeleted();
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator tmp = *this;
+      ++(*this);
+      return tmp;
+    }
+    friend bool operator==(const Iterator &a, const Iterator &b) {
+      return a.n == b.n;
+    }
+    friend bool operator!=(const Iterator &a, const Iterator &b) {
+      return a.n != b.n;
+    }
+
+   private:
+    Node *n = nullptr;  // nullptr - конец
+
+    void move(Node *to) {
+      if (to == nullptr && n) EpochManager::instance().unpin();  // Дошли до конца - эпоха больше не нужна
+      n = to;
+    }
+    void skipDeleted() {
+      while (n && marked(n->next[0].load(std::memory_order_acquire)))
+        move(SkipListSet::pointer(n->next[0].load(std::memory_order_acquire)));
+    }
+  };
+  // Первый узел читается уже под закреплённой эпохой
+  Iterator begin() const {
+    EpochGuard guard;
+    return Iterator(pointer(head->next[0].load(std::memory_order_acquire)));
+  }
+  Iterator end() const {
+    return Iterator();
+  }
+
+  // map, reduce, where (как в Set)
+  // map - применение функции к каждому элементу множества
+  SkipListSet map(T f(T)) const {
+    return map<T (*)(T), T>(f);
+  }
+  template <class F, class U = std::decay_t<std::invoke_result_t<F &, const T &>>>
+  SkipListSet<U> map(F f) const {
+    std::vector<U> values;
+    for (const T &x : *this) values.push_back(f(x));
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    return SkipListSet<U>::fromSorted(values);
+  }
+  // where фильтрует значения с помощью функции-фильтра h
+  SkipListSet where(bool h(T)) const {
+    return where<bool (*)(T)>(h);
+  }
+  template <class H>
+  SkipListSet where(H h) const {
+    std::vector<T> values;
+    for (const T &x : *this)
+      if (h(x)) values.push_back(x);
+    return fromSorted(values);
+  }
+  // reduce - применяем к каждой паре значений пока не получим одно значение
+  T reduce(T f(T, T)) const {
+    return reduce<T (*)(T, T)>(f);
+  }
+  template <class F>
+  T reduce(F f) const {
+    Iterator it = begin(), last = end();
+    if (it == last) throw std::range_error("Empty set");
+    T value = *it;
+    for (++it; it != last; ++it) value = f(value, *it);
+    return value;
+  }
+  // Объединение, пересечение и разность: слияние двух упорядоченных обходов за O(n + m)
+  SkipListSet setUnion(const SkipListSet &s) const {
+    std::vector<T> res;
+    std::set_union(begin(), end(), s.begin(), s.end(), std::back_inserter(res));
+    return fromSorted(res);
+  }
+  SkipListSet intersection(const SkipListSet &s) const {
+    std::vector<T> res;
+    std::set_intersection(begin(), end(), s.begin(), s.end(), std::back_inserter(res));
+    return fromSorted(res);
+  }
+  SkipListSet difference(const SkipListSet &s) const {
+    std::vector<T> res;
+    std::set_difference(begin(), end(), s.begin(), s.end(), std::back_inserter(res));
+    return fromSorted(res);
+  }
+  // Является ли подмножеством set
+  bool subSet(const SkipListSet &set) const {
+    return std::includes(set.begin(), set.end(), begin(), end());
+  }
+  bool equal(const SkipListSet &set) const {
+    return subSet(set) && set.subSet(*this);
+  }
+  // Сохраним в строку
+  std::string toString() const {
+    TextWriter out;
+    for (const T &x : *this) {
+      out.value(x);
+      out.put(' ');
+    }
+    return out.take();
+  }
+
+  template <typename>
+  friend class SkipListSet;
+};
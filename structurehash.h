@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+// Структурный хеш поддерева (как в дереве Меркла): хеш узла считается по хешам его левого и правого
+// поддеревьев и хешу значения. Одинаковые по форме и значениям поддеревья имеют одинаковый хеш,
+// поэтому разные поддеревья почти всегда отличаются уже по хешу - за O(1), без обхода.
+// Левое и правое поддеревья перемешиваются по-разному, чтобы зеркальные деревья различались
+struct StructureHash {
+  // Хеш пустого поддерева. Не 0: mix(0) == 0, и узел с нулевым хешем значения не должен совпадать
+  // с отсутствующим поддеревом
+  static constexpr uint64_t EMPTY = 0x6a09e667f3bcc909ull;
+
+  // Хеш значения: std::hash, если он определён для T. Иначе 0 - тогда хеш учитывает только форму дерева
+  // и по-прежнему годится для отсева: равные поддеревья всё равно имеют равные хеши
+  template <class T>
+  static uint64_t ofValue(const T &value) {
+    if constexpr (hashable<T>(0)) {
+      return (uint64_t)std::hash<T>()(value);
+    } else {
+      return 0;
+    }
+  }
+  // Хеш узла по хешам поддеревьев и значения: одно перемешивание на узел - хеш пересчитывается
+  // на всём пути от изменённого узла до корня при каждой вставке и удалении.
+  // Константа NODE отличает узел от пустого поддерева и при нулевом хеше значения
+  static uint64_t combine(uint64_t left, uint64_t value, uint64_t right) {
+    return mix(left * 0x9e3779b97f4a7c15ull + right * 0xc2b2ae3d27d4eb4full + value + NODE);
+  }
+
+ private:
+  static constexpr uint64_t NODE = 0xbb67ae8584caa73bull;
+  // Перемешивание бит 64-битного числа (финализатор MurmurHash3)
+  static uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+  }
+  template <class T>
+  static constexpr auto hashable(int) -> decltype(std::hash<T>()(std::declval<const T &>()), bool()) {
+    return true;
+  }
+  template <class T>
+  static constexpr bool hashable(...) {
+    return false;
+  }
+};
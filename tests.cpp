@@ -3,11 +3,15 @@
 #include <chrono>
 #include <complex>
 #include <cstdlib>
+#include <numeric>
 
 #include "binaryheap.h"
 #include "binarytree.h"
+#include "concurrenttree.h"
 #include "gtest/gtest.h"
 #include "set.h"
+#include "shardedset.h"
+#include "skiplistset.h"
 
 using namespace std;
 
@@ -62,6 +66,13 @@ void checkIterator(BinaryTree<int> &bt, vector<int> vec) {
   }
   ASSERT_EQ(vec.end(), itVec);
   ASSERT_EQ(bt.end(), it);
+  // Итератор двунаправленный: проходим в обратном порядке
+  for (size_t i = 0; i < vec.size(); i++) {
+    itVec--;
+    it--;
+    ASSERT_EQ(*itVec, *it);
+  }
+  ASSERT_EQ(bt.begin(), it);
 }
 
 // Пример дерева поиска из Википедии
@@ -78,7 +89,7 @@ TEST(BinaryTree, small_tree) {
   ASSERT_EQ(string("3 8"), bt.toString("L N R"));
   ASSERT_EQ(3 + 8, bt.reduce(sum));
   bt.insert(10);
-  checkIterator(bt, vector<int>({8, 3, 10}));
+  checkIterator(bt, vector<int>({3, 8, 10}));
   ASSERT_EQ(2, bt.height());
   // Сохранение в строку
   // - по фиксированному обходу
@@ -102,7 +113,7 @@ TEST(BinaryTree, small_tree) {
   bt.insert(1);
   ASSERT_EQ(string("1 3 8 10"), bt.toLNR());
   ASSERT_EQ(string("1 3  8 10"), bt.toString("L N R"));
-  checkIterator(bt, vector<int>({8, 3, 1, 10}));
+  checkIterator(bt, vector<int>({1, 3, 8, 10}));
   bt.insert(6);
   ASSERT_EQ(string("1 3 6 8 10"), bt.toLNR());
   bt.insert(4);
@@ -114,7 +125,7 @@ TEST(BinaryTree, small_tree) {
   bt.insert(13);
   ASSERT_EQ(string("1 3 4 6 7 8 10 13 14"), bt.toLNR());
   ASSERT_EQ(string("6 3 1 4 8 7 13 10 14"), bt.toNLR());
-  checkIterator(bt, vector<int>({6, 3, 1, 4, 8, 7, 13, 10, 14}));
+  checkIterator(bt, vector<int>({1, 3, 4, 6, 7, 8, 10, 13, 14}));
   // Извлечение поддерева (по заданному корню)
   BinaryTree<int> *subTree = bt.subTree(13);
   ASSERT_EQ(string("13 10 14"), subTree->toNLR());
@@ -162,14 +173,12 @@ TEST(BinaryTree, iterator) {
   ASSERT_EQ(10, lnr->next->next->value);
   ASSERT_EQ(nullptr, lnr->next->next->next);
   // map - применение операции к каждому элементу
-  BinaryTree<int> *sq = bt.map(square);
+  BinaryTree<int> sq = bt.map(square);
   bt.printAsTree();
-  ASSERT_EQ("9 64 100", sq->toLNR());
-  delete sq;
+  ASSERT_EQ("9 64 100", sq.toLNR());
   // where
-  BinaryTree<int> *sq2 = bt.where(isEven);
-  ASSERT_EQ(string("8 10"), sq2->toLNR());
-  delete sq2;
+  BinaryTree<int> sq2 = bt.where(isEven);
+  ASSERT_EQ(string("8 10"), sq2.toLNR());
   // reduce
   ASSERT_EQ(3 + 8 + 10, bt.reduce(sum));
 }
@@ -216,10 +225,564 @@ TEST(BinaryTree, base_operations_insert_find_remove) {
   }
 }
 
+// Пул узлов: освобождённые узлы используются повторно
+TEST(BinaryTree, node_pool) {
+  NodePool<BinaryTree<int>::Node> pool;
+  BinaryTree<int>::Node *a = pool.create(1);
+  BinaryTree<int>::Node *b = pool.create(2);
+  ASSERT_EQ(2, b->value);
+  pool.destroy(a);
+  ASSERT_EQ(a, pool.create(3));  // Ячейка из списка свободных
+  // Дерево на пуле и дерево на new/delete ведут себя одинаково
+  BinaryTree<int> pooled;
+  BinaryTree<int> heap(NodeAllocation::Heap);
+  for (int i = 0; i < 1000; i++) {
+    int value = (i * 37 + 11) % 1000;  // Все значения различны
+    pooled.insert(value);
+    heap.insert(value);
+    if (i % 3 == 0) {
+      pooled.remove(value / 2);
+      heap.remove(value / 2);
+    }
+  }
+  ASSERT_EQ(heap.getSize(), pooled.getSize());
+  ASSERT_EQ(heap.toNLR(), pooled.toNLR());
+  pooled.check();
+  // Перемещение передаёт узлы вместе с пулом
+  BinaryTree<int> moved(std::move(pooled));
+  ASSERT_EQ(0, pooled.getSize());
+  ASSERT_EQ(heap.toNLR(), moved.toNLR());
+}
+
+// Построение сбалансированного дерева за O(n)
+TEST(BinaryTree, bulk_build) {
+  set<int> values;
+  for (int i = 0; i < 1000; i++) values.insert(rand() % 100000);
+  BinaryTree<int> bt(values);
+  ASSERT_EQ(values.size(), bt.getSize());
+  bt.check();
+  // Высота идеально сбалансированного дерева: ceil(log2(n + 1))
+  int minHeight = 0;
+  while ((1 << minHeight) < (int)values.size() + 1) minHeight++;
+  ASSERT_EQ(minHeight, bt.height());
+  vector<int> sorted(values.begin(), values.end());
+  checkIterator(bt, sorted);
+  // Неотсортированный массив сортируется перед построением
+  int data[] = {5, 1, 4, 2, 3};
+  BinaryTree<int> bt2(data, _countof(data));
+  ASSERT_EQ("3 2 1 5 4", bt2.toNLR());
+  bt2.check();
+  // Множество из строки и списка: повторы отбрасываются
+  Set<int> s("4 2 4 1 2");
+  ASSERT_EQ(3, s.size());
+  ASSERT_EQ("1 2 4", s.toString());
+  ASSERT_EQ(2, Set<int>({7, 7, 3}).size());
+}
+
+// Разделение и соединение деревьев
+TEST(BinaryTree, split_join) {
+  vector<int> values;
+  for (int i = 0; i < 1000; i++) values.push_back(i * 2);
+  BinaryTree<int> bt(values.data(), (int)values.size());
+  BinaryTree<int> left, right;
+  ASSERT_TRUE(bt.split(500, left, right));
+  ASSERT_EQ(0, bt.getSize());
+  ASSERT_EQ(250, left.getSize());
+  ASSERT_EQ(749, right.getSize());
+  left.check();
+  right.check();
+  ASSERT_EQ(498, left.maximum()->value);
+  ASSERT_EQ(502, right.minimum()->value);
+  ASSERT_FALSE(right.split(777, left, bt));
+  ASSERT_EQ(138, left.getSize());
+  ASSERT_EQ(611, bt.getSize());
+  // Соединяем обратно с пропущенным ключом
+  BinaryTree<int> joined = BinaryTree<int>::join(std::move(left), 777, std::move(bt));
+  joined.check();
+  ASSERT_EQ(750, joined.getSize());
+  ASSERT_EQ(750, joined.calcSize());
+  ASSERT_TRUE(joined.find(777));
+  ASSERT_TRUE(joined.find(1998));
+  ASSERT_FALSE(joined.find(500));
+}
+
+// Параллельные операции над деревьями как над множествами
+TEST(BinaryTree, parallel_set_operations) {
+  ThreadPool threads(3);
+  for (int n : {0, 10, 5000}) {
+    set<int> a, b;
+    for (int i = 0; i < n; i++) {
+      a.insert(rand() % (4 * n));
+      b.insert(rand() % (4 * n));
+    }
+    BinaryTree<int> at(a), bt(b);
+    vector<pair<BinaryTree<int>, set<int>>> results;
+    set<int> check;
+    set_union(a.begin(), a.end(), b.begin(), b.end(), inserter(check, check.end()));
+    results.emplace_back(BinaryTree<int>::setUnion(at, bt, threads), check);
+    check.clear();
+    set_intersection(a.begin(), a.end(), b.begin(), b.end(), inserter(check, check.end()));
+    results.emplace_back(BinaryTree<int>::intersection(at, bt, threads), check);
+    check.clear();
+    set_difference(a.begin(), a.end(), b.begin(), b.end(), inserter(check, check.end()));
+    results.emplace_back(BinaryTree<int>::difference(at, bt, threads), check);
+    for (auto &r : results) {
+      ASSERT_EQ(r.second.size(), r.first.getSize());
+      ASSERT_EQ(r.second.size(), r.first.calcSize());
+      if (r.first.getSize()) r.first.check();
+      ASSERT_TRUE(equal(r.second.begin(), r.second.end(), r.first.begin()));
+    }
+  }
+}
+
+// Порядковые статистики: k-й элемент и позиция элемента
+TEST(BinaryTree, order_statistics) {
+  BinaryTree<int> bt;
+  vector<int> sorted;
+  for (int i = 0; i < 500; i++) {
+    int value = (i * 31 + 7) % 500 * 3;  // Различные значения, кратные 3
+    bt.insert(value);
+    sorted.insert(lower_bound(sorted.begin(), sorted.end(), value), value);
+  }
+  for (int i = 0; i < 100; i++) {  // Удаляем каждый второй из первых 200
+    bt.remove(sorted[i]);
+    sorted.erase(sorted.begin() + i);
+  }
+  bt.check();
+  ASSERT_EQ(sorted.size(), bt.getSize());
+  ASSERT_EQ(sorted.size(), bt.subTreeSize(bt.getRoot()));
+  for (int k = 0; k < (int)sorted.size(); k++) {
+    ASSERT_EQ(sorted[k], bt.select(k)->value);
+    ASSERT_EQ(k, bt.rank(sorted[k]));
+    ASSERT_EQ(k, bt.countLess(sorted[k]));
+    ASSERT_EQ(k + 1, bt.countLess(sorted[k] + 1));
+    ASSERT_EQ(-1, bt.rank(sorted[k] + 1));
+  }
+  ASSERT_THROW(bt.select(-1), IndexOutOfRange);
+  ASSERT_THROW(bt.select((int)sorted.size()), IndexOutOfRange);
+  Set<int> s{10, 30, 20};
+  ASSERT_EQ(20, s.select(1));
+  ASSERT_EQ(2, s.rank(30));
+  ASSERT_EQ(3, s.countLess(31));
+}
+
+// Снимок дерева в раскладке Эйтцингера
+TEST(BinaryTree, freeze) {
+  for (int n : {0, 1, 2, 7, 8, 100, 1000}) {
+    BinaryTree<int> bt;
+    for (int i = 0; i < n; i++) bt.insert((i * 7919) % n * 2);  // Чётные 0..2n-2
+    FrozenTree<int> frozen = bt.freeze();
+    ASSERT_EQ(n, frozen.size());
+    ASSERT_TRUE(equal(bt.begin(), bt.end(), frozen.begin(), frozen.end()));
+    vector<int> backwards(frozen.begin(), frozen.end());
+    reverse(backwards.begin(), backwards.end());
+    auto it = frozen.end();
+    for (int x : backwards) ASSERT_EQ(x, *--it);
+    ASSERT_EQ(frozen.begin(), it);
+    for (int v = -1; v <= 2 * n; v++) {
+      ASSERT_EQ(v >= 0 && v % 2 == 0 && v < 2 * n, frozen.contains(v));
+      auto lb = frozen.lowerBound(v);
+      int expected = v < 0 ? 0 : (v + 1) / 2 * 2;  // Ближайшее чётное >= v
+      if (expected >= 2 * n)
+        ASSERT_EQ(frozen.end(), lb);
+      else
+        ASSERT_EQ(expected, *lb);
+    }
+  }
+}
+
+// Вставка и удаление без рекурсии строят то же дерево, что и рекурсивные
+TEST(BinaryTree, iterative_insert_remove) {
+  BinaryTree<int> iterative, recursive;
+  for (int i = 0; i < 3000; i++) {
+    int value = (i * 7907) % 3000;
+    iterative.insert(value);
+    recursive.insertRecursive(value);
+  }
+  ASSERT_EQ(recursive.toNLR(), iterative.toNLR());
+  iterative.check();
+  for (int i = 0; i < 3000; i += 3) {
+    int value = (i * 7907) % 3000;
+    iterative.remove(value);
+    recursive.removeRecursive(value);
+    iterative.remove(-1);  // Удаление отсутствующего значения ничего не меняет
+  }
+  ASSERT_EQ(recursive.toNLR(), iterative.toNLR());
+  ASSERT_EQ(2000, iterative.getSize());
+  ASSERT_EQ(2000, iterative.calcSize());
+  iterative.check();
+  // Копия и сравнение деревьев
+  BinaryTree<int> *copy = iterative.subTree(iterative.getRoot()->value);
+  ASSERT_TRUE(copy->match(iterative));
+  copy->check();
+  delete copy;
+  ASSERT_EQ(iterative.reduce(sum), recursive.reduce(sum));
+  // Некоммутативная свёртка идёт по возрастанию независимо от формы дерева: f(f(x1, x2), x3)
+  BinaryTree<string> words;
+  for (const char *w : {"d", "b", "f", "a", "c", "e", "g"}) words.insert(w);
+  ASSERT_EQ("abcdefg", words.reduce([](const string &a, const string &b) { return a + b; }));
+  ASSERT_EQ("((((((a,b),c),d),e),f),g)",
+            words.reduce([](const string &a, const string &b) { return "(" + a + "," + b + ")"; }));
+}
+
+// Вставка без повторов за один спуск
+TEST(BinaryTree, insert_unique) {
+  BinaryTree<int> bt;
+  for (int i = 0; i < 1000; i++) {
+    int value = rand() % 300;
+    bool present = bt.find(value) != nullptr;
+    int sizeBefore = bt.getSize();
+    auto res = bt.insertUnique(value);
+    ASSERT_EQ(!present, res.second);
+    ASSERT_EQ(value, res.first->value);
+    ASSERT_EQ(res.first, bt.find(value));
+    ASSERT_EQ(sizeBefore + res.second, bt.getSize());
+  }
+  bt.check();
+  ASSERT_EQ(bt.calcSize(), bt.getSize());
+  Set<int> s;
+  ASSERT_TRUE(s.insert(5));
+  ASSERT_FALSE(s.insert(5));
+  ASSERT_EQ(1, s.size());
+}
+
+// Агрегаты поддеревьев: сумма всего дерева за O(1) и отрезка за O(log n)
+TEST(BinaryTree, aggregate) {
+  BinaryTree<int, SumAggregate<int>> bt;
+  BinaryTree<int, MinAggregate<int>> minTree;
+  set<int> check;
+  ASSERT_EQ(0, bt.reduce());
+  for (int i = 0; i < 2000; i++) {
+    int value = rand() % 1000;
+    if (check.count(value)) {
+      check.erase(value);
+      bt.remove(value);
+      minTree.remove(value);
+    } else {
+      check.insert(value);
+      bt.insertUnique(value);
+      minTree.insertUnique(value);
+    }
+    ASSERT_EQ(accumulate(check.begin(), check.end(), 0), bt.reduce());
+    ASSERT_EQ(check.empty() ? INT_MAX : *check.begin(), minTree.reduce());
+  }
+  for (int lo = -10; lo < 1010; lo += 37) {
+    for (int hi = lo - 5; hi < 1010; hi += 53) {
+      int expected = 0;
+      for (auto it = check.lower_bound(lo); it != check.end() && *it <= hi; ++it) expected += *it;
+      ASSERT_EQ(expected, bt.reduceRange(lo, hi));
+      auto first = check.lower_bound(lo);
+      ASSERT_EQ(first != check.end() && *first <= hi ? *first : INT_MAX, minTree.reduceRange(lo, hi));
+    }
+  }
+  // Агрегат сохраняется при построении, копировании и операциях над множествами
+  Set<int, SumAggregate<int>> a{1, 2, 3, 4}, b{3, 4, 5};
+  ASSERT_EQ(10, a.reduce());
+  ASSERT_EQ(15, a.setUnion(b).reduce());
+  ASSERT_EQ(7, a.intersection(b).reduce());
+  ASSERT_EQ(5, a.reduceRange(2, 3));
+}
+
+// Параллельные map, where, reduce
+TEST(BinaryTree, parallel_map_where_reduce) {
+  ThreadPool threads(3);
+  for (int n : {1, 100, 50000}) {
+    BinaryTree<int> bt;
+    Set<int> s;
+    for (int i = 0; i < n; i++) {
+      int value = rand() % 2000 - 1000;
+      bt.insert(value);
+      s.insert(value);
+    }
+    BinaryTree<int> mapped = bt.parallelMap(square, threads);
+    ASSERT_EQ(bt.getSize(), mapped.getSize());
+    BinaryTree<int> expectedMap = bt.map(square);
+    ASSERT_TRUE(equal(expectedMap.begin(), expectedMap.end(), mapped.begin()));
+    BinaryTree<int> filtered = bt.parallelWhere(isEven, threads);
+    BinaryTree<int> expectedWhere = bt.where(isEven);
+    ASSERT_EQ(expectedWhere.getSize(), filtered.getSize());
+    ASSERT_TRUE(equal(expectedWhere.begin(), expectedWhere.end(), filtered.begin()));
+    ASSERT_EQ(bt.reduce(sum), bt.parallelReduce(sum, threads));
+    ASSERT_EQ(s.map(square).toString(), s.parallelMap(square, threads).toString());
+    ASSERT_EQ(s.where(isEven).toString(), s.parallelWhere(isEven, threads).toString());
+    ASSERT_EQ(s.reduce(sum), s.parallelReduce(sum, threads));
+  }
+}
+
+// map, where, reduce с лямбдами и другим типом результата
+TEST(BinaryTree, callable_map_where_reduce) {
+  BinaryTree<int> bt{5, -3, 8, 1, 10, 4};
+  int calls = 0;  // Лямбда с состоянием
+  BinaryTree<int> shifted = bt.map([&calls](int x) {
+    calls++;
+    return x + 100;
+  });
+  ASSERT_EQ(6, calls);
+  ASSERT_EQ(vector<int>({97, 101, 104, 105, 108, 110}), vector<int>(shifted.begin(), shifted.end()));
+  BinaryTree<double> halves = bt.map([](int x) { return x / 2.0; });
+  ASSERT_EQ(6, halves.getSize());
+  ASSERT_EQ(-1.5, *halves.begin());
+  // Возрастающая функция: форма дерева копируется
+  BinaryTree<long long> big = bt.mapMonotone([](int x) { return x * 1000000000LL; });
+  big.check();
+  ASSERT_EQ(bt.toString("N(L)[R]"), shifted.mapMonotone([](int x) { return x - 100; }).toString("N(L)[R]"));
+  ASSERT_EQ(10000000000LL, *--big.end());
+  // Большое дерево: f вызывается по возрастанию, форма и агрегаты совпадают
+  BinaryTree<int> many;
+  for (int i = 0; i < 1000; i++) many.insert(i * 37 % 1000);
+  vector<int> seen;
+  BinaryTree<int> doubled = many.mapMonotone([&seen](int x) {
+    seen.push_back(x);
+    return 2 * x + 1;
+  });
+  doubled.check();
+  ASSERT_TRUE(is_sorted(seen.begin(), seen.end()));
+  ASSERT_EQ(1000u, seen.size());
+  ASSERT_EQ(many.toString("N(L)[R]"), many.mapMonotone([](int x) { return x; }).toString("N(L)[R]"));
+  ASSERT_EQ(many.map([](int x) { return 2 * x + 1; }).toString(), doubled.toString());
+  ASSERT_TRUE(BinaryTree<int>().mapMonotone([](int x) { return x; }).getSize() == 0);
+  int threshold = 4;
+  BinaryTree<int> above = bt.where([threshold](int x) { return x > threshold; });
+  ASSERT_EQ(vector<int>({5, 8, 10}), vector<int>(above.begin(), above.end()));
+  ASSERT_EQ(25, bt.reduce([](int a, int b) { return a + b; }));
+
+  Set<int> s{3, -3, 2, -2};
+  Set<int> squares = s.map([](int x) { return x * x; });
+  ASSERT_EQ(2, squares.size());
+  Set<string> names = s.map([](int x) { return to_string(x); });
+  ASSERT_EQ(4, names.size());
+  ASSERT_TRUE(names.find("-3"));
+  ASSERT_EQ(s.toString(), s.mapMonotone([](int x) { return x * 2; }).where([](int x) { return x % 2 == 0; })
+                              .map([](int x) { return x / 2; }).toString());
+  ASSERT_EQ(0, s.reduce([](int a, int b) { return a + b; }));
+
+  Tree<int, 3> tree;
+  for (int value = 1; value <= 10; value++) tree.insert(value);
+  Tree<int, 3> *odd = tree.where([](int x) { return x % 2 == 1; });
+  ASSERT_EQ(25, odd->reduce(sum));
+  Tree<int, 3> *doubled = tree.map([](int x) { return 2 * x; });
+  ASSERT_EQ(110, doubled->reduce([](int a, int b) { return a + b; }));
+  delete odd;
+  delete doubled;
+}
+
+// Значение, которое считает свои копирования
+struct Counted {
+  static int copies;
+  int value;
+  explicit Counted(int value) : value(value) {}
+  Counted(const Counted &other) : value(other.value) {
+    copies++;
+  }
+  Counted(Counted &&) = default;
+  Counted &operator=(const Counted &other) {
+    value = other.value;
+    copies++;
+    return *this;
+  }
+  Counted &operator=(Counted &&) = default;
+  bool operator<(const Counted &other) const {
+    return value < other.value;
+  }
+  bool operator<=(const Counted &other) const {
+    return value <= other.value;
+  }
+  bool operator==(const Counted &other) const {
+    return value == other.value;
+  }
+};
+int Counted::copies = 0;
+
+// Копирование, перемещение, вставка без копий
+TEST(BinaryTree, copy_move) {
+  BinaryTree<int> a{5, 3, 8, 1, 4};
+  BinaryTree<int> b(a);  // Глубокая копия
+  b.insert(10);
+  a.remove(3);
+  checkIterator(a, {1, 4, 5, 8});
+  checkIterator(b, {1, 3, 4, 5, 8, 10});
+  auto *root = b.getRoot();
+  BinaryTree<int> c(std::move(b));  // Узлы не копируются
+  ASSERT_EQ(root, c.getRoot());
+  ASSERT_EQ(0, b.getSize());
+  b = c;  // Копирующее присваивание
+  c = std::move(a);  // Перемещающее присваивание
+  checkIterator(b, {1, 3, 4, 5, 8, 10});
+  checkIterator(c, {1, 4, 5, 8});
+  c = c;
+  checkIterator(c, {1, 4, 5, 8});
+  BinaryTree<int> heap(NodeAllocation::Heap);
+  heap.insert(1);
+  BinaryTree<int> heapCopy(heap);
+  checkIterator(heapCopy, {1});
+
+  Counted::copies = 0;
+  BinaryTree<Counted> counted;
+  for (int i = 0; i < 100; i++) counted.insert(Counted(i * 7 % 100));
+  for (int i = 100; i < 200; i++) counted.emplace(i);
+  ASSERT_EQ(0, Counted::copies);
+  ASSERT_EQ(200, counted.getSize());
+  counted.check();
+  Set<Counted> s;
+  ASSERT_TRUE(s.insert(Counted(1)));
+  ASSERT_TRUE(s.emplace(2));
+  ASSERT_FALSE(s.emplace(1));
+  ASSERT_EQ(0, Counted::copies);
+  Set<Counted> sCopy = s;
+  ASSERT_EQ(2, Counted::copies);
+  Set<Counted> sMoved = std::move(s);
+  ASSERT_EQ(2, Counted::copies);
+  ASSERT_EQ(2, sMoved.size());
+  ASSERT_TRUE(sCopy.find(Counted(2)));
+
+  BinaryTree<wstring> strings;
+  wstring longString(1000, L'x');
+  strings.insert(std::move(longString));
+  ASSERT_EQ(1000u, strings.getRoot()->value.size());
+}
+
+// Персистентное дерево: снимки не меняются при изменении дерева
+TEST(BinaryTree, persistent) {
+  BinaryTree<int> bt{5, 3, 8, 1, 4};
+  PersistentTree<int> pt = bt.persistent();
+  ASSERT_TRUE(equal(bt.begin(), bt.end(), pt.begin()));
+  PersistentTree<int> before = pt.snapshot();
+  set<int> check(bt.begin(), bt.end());
+  vector<set<int>> versions;
+  vector<PersistentTree<int>> snapshots;
+  for (int i = 0; i < 2000; i++) {
+    int value = rand() % 500;
+    if (rand() % 3 == 0) {
+      ASSERT_EQ(check.erase(value) > 0, pt.remove(value));
+    } else if (check.insert(value).second) {
+      pt.insert(value);
+    }
+    if (i % 100 == 0) {
+      versions.push_back(check);
+      snapshots.push_back(pt.snapshot());
+    }
+  }
+  pt.check();
+  ASSERT_EQ(check.size(), pt.getSize());
+  ASSERT_TRUE(equal(check.begin(), check.end(), pt.begin()));
+  ASSERT_TRUE(equal(bt.begin(), bt.end(), before.begin()));
+  for (size_t i = 0; i < snapshots.size(); i++) {
+    snapshots[i].check();
+    ASSERT_EQ(versions[i].size(), snapshots[i].getSize());
+    ASSERT_TRUE(equal(versions[i].begin(), versions[i].end(), snapshots[i].begin()));
+  }
+  // Поддерево разделяет узлы и не меняется вместе с деревом
+  int minValue = *pt.begin();
+  PersistentTree<int> all = pt.subTree(minValue);  // Поддерево с корнем в узле минимума
+  ASSERT_EQ(minValue, *all.begin());
+  ASSERT_EQ(0, pt.subTree(-1).getSize());
+  PersistentTree<int> copy = pt;
+  pt.remove(minValue);
+  ASSERT_EQ(check.size(), copy.getSize());
+  ASSERT_TRUE(copy.contains(minValue));
+  ASSERT_FALSE(pt.contains(minValue));
+  ASSERT_FALSE(pt.find(minValue).has_value());
+  ASSERT_TRUE(all.contains(minValue));  // Удалённое значение осталось в прежнем поддереве
+  ASSERT_EQ(minValue, all.find(minValue).value());
+}
+
+// Дерево для многих потоков: сначала один поток (точный АВЛ-баланс), затем несколько
+TEST(BinaryTree, concurrent_tree) {
+  ConcurrentTree<int> tree;
+  set<int> check;
+  for (int i = 0; i < 20000; i++) {
+    int value = rand() % 3000;
+    if (rand() % 3 == 0)
+      ASSERT_EQ(check.erase(value) > 0, tree.remove(value));
+    else
+      ASSERT_EQ(check.insert(value).second, tree.insert(value));
+    ASSERT_EQ(check.size(), tree.getSize());
+  }
+  tree.check();
+  ASSERT_EQ(vector<int>(check.begin(), check.end()), tree.toVector());
+  for (int value = 0; value < 3000; value++) ASSERT_EQ(check.count(value) > 0, tree.find(value));
+
+  // Каждый поток вставляет свои ключи и удаляет нечётные из них, одновременно ищет чужие
+  ConcurrentTree<int> shared;
+  const int THREADS = 4, KEYS = 20000;
+  vector<thread> workers;
+  for (int t = 0; t < THREADS; t++) {
+    workers.emplace_back([&shared, t] {
+      for (int i = 0; i < KEYS; i++) {
+        shared.insert(i * THREADS + t);
+        shared.find((i * 7 + t) % (KEYS * THREADS));
+      }
+      for (int i = 1; i < KEYS; i += 2) shared.remove(i * THREADS + t);
+    });
+  }
+  for (auto &w : workers) w.join();
+  shared.check(false);
+  vector<int> expected;
+  for (int i = 0; i < KEYS * THREADS; i++)
+    if ((i / THREADS) % 2 == 0) expected.push_back(i);
+  ASSERT_EQ(expected.size(), shared.getSize());
+  ASSERT_EQ(expected, shared.toVector());
+  ASSERT_LE(shared.height(), 40);
+}
+
+// Объект, который считает свои удаления
+struct Reclaimed {
+  static atomic<int> deleted;
+  ~Reclaimed() {
+    deleted++;
+  }
+};
+atomic<int> Reclaimed::deleted{0};
+
+// Отложенное освобождение памяти: пока эпоха закреплена, объект не удаляется
+TEST(BinaryTree, epoch_reclamation) {
+  EpochManager &epochs = EpochManager::instance();
+  {
+    EpochGuard guard;
+    epochs.retire(new Reclaimed);
+    for (int i = 0; i < 5; i++) epochs.collect();
+    ASSERT_EQ(0, Reclaimed::deleted);
+  }
+  for (int i = 0; i < 5; i++) epochs.collect();
+  ASSERT_EQ(1, Reclaimed::deleted);
+
+  // Обход одновременно с изменениями: чётные значения не меняются и должны быть пройдены по порядку,
+  // нечётные вставляются и удаляются другим потоком, вырезанные узлы освобождаются по ходу работы
+  ConcurrentTree<int> tree;
+  const int KEYS = 4000;
+  for (int i = 0; i < KEYS; i += 2) tree.insert(i);
+  atomic<bool> stop{false};
+  thread writer([&] {
+    for (int round = 0; !stop; round++) {
+      for (int i = 1; i < KEYS; i += 2) tree.insert(i);
+      for (int i = 1; i < KEYS; i += 2) tree.remove(i);
+    }
+  });
+  for (int scan = 0; scan < 20; scan++) {
+    int previous = -1, evens = 0;
+    for (int x : tree) {
+      ASSERT_LT(previous, x);
+      previous = x;
+      if (x % 2 == 0) {
+        ASSERT_EQ(2 * evens++, x);
+      }
+    }
+    ASSERT_EQ(KEYS / 2, evens);
+  }
+  stop = true;
+  writer.join();
+  vector<int> expected;
+  for (int i = 0; i < KEYS; i += 2) expected.push_back(i);
+  ASSERT_EQ(expected, tree.toVector());
+  ASSERT_EQ(expected, vector<int>(tree.begin(), tree.end()));
+}
+
 // Балансировка
 TEST(BinaryTree, leftRotation) {
-  BinaryTree<double> bt{3, 2, 1};
+  BinaryTree<double> bt;
+  for (double x : {3.0, 2.0, 1.0}) bt.insert(x);  // По одному: конструктор из списка строит дерево без вращений
   // Автоматически прошёл баланс - Малое правое вращение
+  ASSERT_EQ(2.0, bt.getRoot()->value);
   ASSERT_EQ(2, bt.height(bt.getRoot()));
   ASSERT_EQ(0, bt.disbalance_check(bt.getRoot()));
   // Дерево должно выглядеть так:
@@ -249,8 +812,281 @@ TEST(BinaryTree, leftRotation) {
   ASSERT_EQ(1, bt.disbalance_check(bt.getRoot()));
 }
 
+// Прежний рекурсивный вывод по формату - эталон для скомпилированной программы
+template <class Node>
+void printByFormat(const Node *n, const char *format, ostringstream &os) {
+  if (!n->left && !n->right) {
+    os << n->value;
+    return;
+  }
+  for (const char *f = format; *f; f++) {
+    if (*f == 'N')
+      os << n->value;
+    else if (*f == 'L') {
+      if (n->left) printByFormat(n->left, format, os);
+    } else if (*f == 'R') {
+      if (n->right) printByFormat(n->right, format, os);
+    } else
+      os << *f;
+  }
+}
+
+// Формат компилируется один раз в программу и выполняется явным стеком
+TEST(BinaryTree, format_program) {
+  FormatProgram p("(N)--[L]{R}");
+  ASSERT_EQ(7u, p.instructions().size());  // "--" и "]{" - по одному фрагменту текста
+  BinaryTree<int> bt;
+  for (int i = 0; i < 1000; i++) bt.insert(i * 37 % 1009);
+  for (const char *format : {"N L R", "(N)[L]{R}", "L N R", "RNL", "<N>", "NLRN", " L;R "}) {
+    ostringstream expected;
+    printByFormat(bt.getRoot(), format, expected);
+    ASSERT_EQ(trim_copy(expected.str()), bt.toString(format)) << format;
+    ostringstream sink;
+    bt.printTo(sink, FormatProgram(format));
+    ASSERT_EQ(trim_copy(expected.str()), sink.str()) << format;
+  }
+  // Порядок обхода: одна программа для многих деревьев
+  FormatProgram lrn("LRN", false);
+  for (int n : {0, 1, 2, 5, 100}) {
+    BinaryTree<int> t;
+    for (int i = 0; i < n; i++) t.insert(i);
+    vector<int> visited;
+    lrn.run(t.getRoot(), [&](BinaryTree<int>::Node *node) { visited.push_back(node->value); });
+    ASSERT_EQ((size_t)n, visited.size());
+    string joined;
+    for (int v : visited) joined += (joined.empty() ? "" : " ") + to_string(v);
+    ASSERT_EQ(joined, t.toLRN());
+    if (n) {
+      ASSERT_EQ(t.getRoot()->value, visited.back());
+    }
+  }
+  BinaryTree<int>::Node *rnl = bt.thread("RNL");
+  ASSERT_EQ(1008, rnl->value);
+  ASSERT_EQ(1007, rnl->next->value);
+}
+
+// Связи по возрастанию поддерживаются вставкой, удалением, разделением и соединением
+TEST(BinaryTree, linked_order) {
+  BinaryTree<int> bt;
+  bt.keepLinks();
+  ASSERT_EQ(nullptr, bt.first);
+  std::multiset<int> expected;
+  for (int i = 0; i < 3000; i++) {
+    int x = (int)((i * 2654435761u) % 1000);  // С повторами
+    bt.insert(x);
+    expected.insert(x);
+    if (i % 3 == 0) {
+      int y = (int)((i * 40503u) % 1000);
+      bt.remove(y);
+      auto it = expected.find(y);
+      if (it != expected.end()) expected.erase(it);
+    }
+    if (i % 100 == 0) bt.checkLinks();  // check() требует различных значений
+  }
+  bt.checkLinks();
+  // Проход по списку вперёд и назад
+  vector<int> forward, backward;
+  for (auto n = bt.first; n != nullptr; n = bt.successor(n)) forward.push_back(n->value);
+  for (auto n = bt.last; n != nullptr; n = bt.predecessor(n)) backward.push_back(n->value);
+  ASSERT_EQ(vector<int>(expected.begin(), expected.end()), forward);
+  ASSERT_EQ(vector<int>(expected.rbegin(), expected.rend()), backward);
+  // Прежние рекурсивные вставка и удаление в режиме связей идут обычным путём
+  bt.insertRecursive(1001);
+  bt.removeRecursive(*expected.begin());
+  expected.erase(expected.begin());
+  expected.insert(1001);
+  bt.checkLinks();
+  ASSERT_EQ(*expected.begin(), bt.first->value);
+  ASSERT_EQ(1001, bt.last->value);
+  // Прошивка LNR уже готова и не нужна для просмотра диапазона
+  ASSERT_EQ(bt.first, bt.thread("LNR"));
+  vector<int> range, rangeExpected(expected.lower_bound(100), expected.upper_bound(120));
+  bt.forRange(100, 120, [&](int x) { range.push_back(x); });
+  ASSERT_EQ(rangeExpected, range);
+  // Вставка без повторов, копия, разделение и соединение
+  BinaryTree<int> unique;
+  unique.keepLinks();
+  for (int i = 0; i < 500; i++) ASSERT_EQ(i % 250 == i, unique.insertUnique(i % 250 * 2).second);
+  BinaryTree<int> copy(unique);
+  ASSERT_TRUE(copy.linksKept());
+  copy.check();
+  BinaryTree<int> left, right;
+  ASSERT_TRUE(unique.split(200, left, right));
+  left.check();
+  right.check();
+  ASSERT_EQ(198, left.last->value);
+  ASSERT_EQ(202, right.first->value);
+  BinaryTree<int> joined = BinaryTree<int>::join(std::move(left), 201, std::move(right));
+  joined.check();
+  ASSERT_EQ(201, joined.successor(joined.find(198))->value);
+  ASSERT_EQ(202, joined.successor(joined.find(201))->value);
+  ASSERT_EQ(250, joined.getSize());
+  // Без связей просмотр диапазона идёт итератором; прошивка в другом порядке выключает режим
+  BinaryTree<int> plain(copy);
+  plain.keepLinks(false);
+  range.clear();
+  plain.forRange(7, 13, [&](int x) { range.push_back(x); });
+  ASSERT_EQ(vector<int>({8, 10, 12}), range);
+  copy.thread();
+  ASSERT_FALSE(copy.linksKept());
+}
+
+// Структурные хеши поддеревьев: сравнение за O(1) и поиск поддерева в любом месте дерева
+TEST(BinaryTree, structure_hash) {
+  BinaryTree<int> a, b;
+  for (int i = 0; i < 1000; i++) a.insert(i * 7 % 1000);
+  for (int i = 0; i < 1000; i++) b.insert(i * 7 % 1000);
+  ASSERT_EQ(a.structureHash(), b.structureHash());
+  ASSERT_TRUE(a.match(b));
+  // Хеши поддерживаются при вращениях: check() сверяет хеш каждого узла с пересчитанным
+  b.remove(500);
+  b.check();
+  ASSERT_NE(a.structureHash(), b.structureHash());
+  ASSERT_FALSE(a.match(b));
+  b.insert(500);
+  b.check();
+  BinaryTree<int> copied(b);
+  ASSERT_TRUE(b.match(copied));
+  BinaryTree<int> c;
+  c.buildFromSorted(a.begin(), a.getSize());  // Те же значения, идеально сбалансированная форма
+  ASSERT_EQ(a.getSize(), c.getSize());
+  ASSERT_EQ(a.match(c), a.structureHash() == c.structureHash());
+  // Одно и то же поддерево встречается в дереве с повторами несколько раз: find находит только одно
+  BinaryTree<int> dup;
+  for (int x : {5, 3, 8, 3, 5, 8, 1, 9}) dup.insert(x);
+  auto *sub = dup.subTree(dup.getRoot()->left->value);
+  ASSERT_TRUE(dup.subTreeCheck(sub));
+  delete sub;
+  // Лист с заданным значением находится, где бы он ни был
+  std::set<int> leaves;
+  for (const BinaryTree<int>::Node *n : dup.threadAsVector())
+    if (n->left == nullptr && n->right == nullptr) leaves.insert(n->value);
+  for (int x : {1, 3, 5, 8, 9}) {
+    BinaryTree<int> single{x};
+    ASSERT_EQ(leaves.count(x) == 1, dup.subTreeCheck(&single)) << x;
+  }
+  // Лист со значением, которого нет, и изменение дерева после построения индекса
+  BinaryTree<int> leaf{42};
+  ASSERT_FALSE(dup.subTreeCheck(&leaf));
+  dup.insert(42);
+  ASSERT_TRUE(dup.subTreeCheck(&leaf));
+  dup.remove(42);
+  ASSERT_FALSE(dup.subTreeCheck(&leaf));
+  // Индекс поддеревьев сбрасывается при разделении и соединении: после них находится каждое поддерево
+  auto everySubtreeFound = [](BinaryTree<int> &tree) {
+    bool all = true;
+    for (const BinaryTree<int>::Node *n : tree.threadAsVector()) all = all && tree.containsSubtree(n);
+    return all;
+  };
+  BinaryTree<int> big;
+  for (int i = 0; i < 100; i++) big.insert(i * 2);
+  ASSERT_TRUE(everySubtreeFound(big));  // Индекс построен
+  BinaryTree<int> low, high;
+  big.split(100, low, high);
+  ASSERT_FALSE(big.containsSubtree(low.getRoot()));
+  ASSERT_TRUE(everySubtreeFound(low));
+  ASSERT_TRUE(everySubtreeFound(high));
+  BinaryTree<int> joined = BinaryTree<int>::join(std::move(low), 101, std::move(high));
+  joined.check();
+  ASSERT_TRUE(everySubtreeFound(joined));
+  BinaryTree<int> leaf7{7};
+  ASSERT_FALSE(joined.subTreeCheck(&leaf7));
+  // Те же значения в другой форме: 1 -> правый 2 против 2 -> левый 1
+  BinaryTree<int> l, r;
+  l.insert(1);
+  l.insert(2);
+  r.insert(2);
+  r.insert(1);
+  ASSERT_NE(l.structureHash(), r.structureHash());
+  // Тип без std::hash: хеш учитывает только форму
+  ASSERT_EQ(0u, StructureHash::ofValue(std::complex<double>(1, 0)));
+  // Нулевой хеш значения: узел не совпадает с пустым поддеревом
+  BinaryTree<int> single, withZero;
+  single.insert(5);
+  withZero.insert(5);
+  withZero.insert(0);
+  ASSERT_NE(single.structureHash(), withZero.structureHash());
+  ASSERT_NE(StructureHash::EMPTY, withZero.getRoot()->left->hash);
+  ASSERT_FALSE(single.match(withZero));
+  // Без std::hash разные формы различаются, одинаковые - совпадают
+  BinaryTree<Counted> one, leftChild, rightChild, three, anotherLeftChild;
+  one.insert(Counted(1));
+  for (int x : {2, 1}) leftChild.insert(Counted(x));
+  for (int x : {1, 2}) rightChild.insert(Counted(x));
+  for (int x : {2, 1, 3}) three.insert(Counted(x));
+  for (int x : {7, 6}) anotherLeftChild.insert(Counted(x));
+  ASSERT_NE(StructureHash::EMPTY, one.structureHash());
+  ASSERT_NE(one.structureHash(), leftChild.structureHash());
+  ASSERT_NE(leftChild.structureHash(), rightChild.structureHash());
+  ASSERT_NE(leftChild.structureHash(), three.structureHash());
+  ASSERT_EQ(leftChild.structureHash(), anotherLeftChild.structureHash());
+}
+
+// Рекурсивный обход в порядке order - эталон для итеративного
+template <class Node>
+void recursiveOrder(const Node *n, const char *order, vector<int> &out) {
+  if (n == nullptr) return;
+  for (const char *c = order; *c; c++) {
+    if (*c == 'N') out.push_back(n->value);
+    if (*c == 'L') recursiveOrder(n->left, order, out);
+    if (*c == 'R') recursiveOrder(n->right, order, out);
+  }
+}
+
+// Обходы без рекурсии и без выделения памяти: все шесть порядков, остановка, обход Морриса
+TEST(BinaryTree, traversal_engine) {
+  BinaryTree<int> bt;
+  for (int i = 0; i < 2000; i++) bt.insert(i * 53 % 2003);
+  const char *names[] = {"NLR", "NRL", "LRN", "LNR", "RLN", "RNL"};
+  for (const char *name : names) {
+    Order order;
+    ASSERT_TRUE(parseOrder(name, order));
+    vector<int> expected, visited;
+    recursiveOrder(bt.getRoot(), name, expected);
+    BinaryTree<int>::withOrder(order, [&](auto tag) {
+      bt.traverse<decltype(tag)::value>([&](BinaryTree<int>::Node *n) { visited.push_back(n->value); });
+    });
+    ASSERT_EQ(expected, visited) << name;
+  }
+  Order bad;
+  ASSERT_FALSE(parseOrder("LN", bad));
+  // Строка, которая не задаёт обход из трёх букв, прошивает по буквам, как прежде
+  vector<int> spaced, plain;
+  for (auto n = bt.thread("L-N-R"); n != nullptr; n = n->next) spaced.push_back(n->value);
+  for (auto n = bt.thread("LNR"); n != nullptr; n = n->next) plain.push_back(n->value);
+  ASSERT_EQ(plain, spaced);
+  ASSERT_EQ(nullptr, bt.thread("LR"));  // Узлы не посещаются
+  ASSERT_EQ(nullptr, bt.thread(""));
+
+  // Остановка: первые 10 значений по возрастанию
+  vector<int> firstTen;
+  ASSERT_FALSE(bt.traverse<Order::LNR>([&](BinaryTree<int>::Node *n) {
+    firstTen.push_back(n->value);
+    return firstTen.size() < 10;
+  }));
+  ASSERT_EQ(vector<int>({0, 1, 2, 3, 4, 5, 6, 7, 8, 9}), firstTen);
+
+  // Моррис: тот же порядок; после остановки все временные ссылки сняты
+  vector<int> morris, reverse;
+  ASSERT_TRUE(bt.traverseMorris<Order::LNR>([&](BinaryTree<int>::Node *n) { morris.push_back(n->value); }));
+  ASSERT_EQ(vector<int>(bt.begin(), bt.end()), morris);
+  ASSERT_FALSE(bt.traverseMorris<Order::RNL>([&](BinaryTree<int>::Node *n) {
+    reverse.push_back(n->value);
+    return n->value > 1000;
+  }));
+  ASSERT_EQ(1000, reverse.back());
+  ASSERT_EQ(std::count_if(morris.begin(), morris.end(), [](int v) { return v >= 1000; }), (long)reverse.size());
+  bt.check();
+  vector<int> after;
+  recursiveOrder(bt.getRoot(), "LNR", after);
+  ASSERT_EQ(morris, after);
+  ASSERT_EQ(std::accumulate(morris.begin(), morris.end(), 0), bt.reduce([](int a, int b) { return a + b; }));
+}
+
 TEST(BinaryTree, printAsTree) {
-  BinaryTree<int> bt{3, 2, 1};
+  BinaryTree<int> bt;
+  for (int x : {3, 2, 1}) bt.insert(x);  // Вставка по одному с малым правым вращением
+  ASSERT_EQ(2, bt.getRoot()->value);
   ASSERT_EQ(2, bt.height(bt.getRoot()));
   ASSERT_EQ(0, bt.disbalance_check(bt.getRoot()));
   bt.check(bt.getRoot());
@@ -417,6 +1253,32 @@ TEST(Set, union_intersect_diff) {
   }
 }
 
+// Множества сильно разного размера: поиск элементов меньшего в большем
+TEST(Set, union_intersect_diff_adaptive) {
+  set<int> big;
+  for (int i = 0; i < 5000; i++) big.insert(rand() % 20000);
+  Set<int> bigSet(big);
+  for (int small_size : {0, 1, 5, 40}) {
+    set<int> small;
+    for (int i = 0; i < small_size; i++) small.insert(rand() % 22000);
+    Set<int> smallSet(small);
+    set<int> check = setIntersection(small, big);
+    Set<int> r1 = smallSet.intersection(bigSet);
+    assertEquals(check, r1);
+    Set<int> r2 = bigSet.intersection(smallSet);
+    assertEquals(check, r2);
+    check = setDifference(small, big);
+    Set<int> r3 = smallSet.difference(bigSet);
+    assertEquals(check, r3);
+    check = setDifference(big, small);
+    Set<int> r4 = bigSet.difference(smallSet);
+    assertEquals(check, r4);
+    check = setUnion(big, small);
+    Set<int> result = smallSet.setUnion(bigSet);
+    assertEquals(check, result);
+  }
+}
+
 // map, reduce, where
 // map - применение функции к каждому элементу множества
 TEST(Set, map) {
@@ -458,6 +1320,273 @@ TEST(Set, string) {
   ASSERT_EQ(string(""), emptySet.toString());
 }
 
+// Текст через from_chars/to_chars: разбор до первого не-числа, точная запись double, вывод в поток
+TEST(Set, fast_text) {
+  Set<int> a("  +7\t-3\n12 7 x 5");  // Разбор останавливается на "x", как цикл in >> value
+  ASSERT_EQ("-3 7 12", a.toString());
+  Set<double> d("0.1 2.5e-7 -1e300 3");
+  ASSERT_EQ("-1e+300 2.5e-07 0.1 3", d.toString());
+  ASSERT_TRUE(Set<double>(d.toString()).equal(d));  // Кратчайшая запись читается обратно точно
+
+  Set<int> big;
+  string expected;
+  for (int i = -50000; i < 50000; i += 3) {
+    big.insert(i);
+    expected += to_string(i) + " ";
+  }
+  expected.pop_back();
+  ASSERT_EQ(expected, big.toString());
+  ostringstream sink;
+  big.printTo(sink);
+  ASSERT_EQ(expected, sink.str());
+
+  BinaryTree<int> bt{8, 3, 10};
+  ostringstream treeSink;
+  bt.printTo(treeSink, " (N)[L]{R} ");
+  ASSERT_EQ(bt.toString(" (N)[L]{R} "), treeSink.str());
+  ASSERT_EQ("(8)[3]{10}", treeSink.str());  // Пробелы по краям отброшены
+}
+
+// Двоичный формат: запись и чтение без текста, проверка заголовка, порядка и контрольной суммы
+TEST(Set, binary_format) {
+  Set<int> a;
+  for (int i = 0; i < 100000; i++) a.insert(i * 7 % 100003 - 50000);
+  stringstream out;
+  a.save(out);
+  string bytes = out.str();
+  ASSERT_EQ(16 + a.size() * sizeof(int) + 8, bytes.size());
+
+  stringstream in(bytes);
+  Set<int> b{1, 2};
+  b.load(in);
+  ASSERT_EQ(a.size(), b.size());
+  ASSERT_TRUE(equal(a.begin(), a.end(), b.begin(), b.end()));
+
+  // Дерево с повторами; пустое дерево
+  BinaryTree<double> tree{2.5, -1, 2.5, 7};
+  stringstream treeOut;
+  tree.save(treeOut);
+  BinaryTree<double> treeIn;
+  treeIn.load(treeOut);
+  treeIn.check();
+  ASSERT_EQ(vector<double>({-1, 2.5, 2.5, 7}), vector<double>(treeIn.begin(), treeIn.end()));
+  // ...но в множество дерево с повторами не читается
+  stringstream again;
+  tree.save(again);
+  Set<double> fromTree;
+  ASSERT_THROW(fromTree.load(again), FormatError);
+  Set<int> empty, emptyIn{3};
+  stringstream emptyOut;
+  empty.save(emptyOut);
+  emptyIn.load(emptyOut);
+  ASSERT_EQ(0, emptyIn.size());
+
+  // Испорченные данные: при ошибке множество не меняется
+  auto load = [](const string &data) {
+    Set<int> s{42};
+    stringstream in(data);
+    try {
+      s.load(in);
+    } catch (const FormatError &) {
+      EXPECT_EQ("42", s.toString());
+      throw;
+    }
+  };
+  string corrupted = bytes;
+  corrupted[16 + 1000] ^= 1;  // Ключ изменился, порядок ещё может сохраниться
+  ASSERT_THROW(load(corrupted), FormatError);
+  ASSERT_THROW(load(bytes.substr(0, bytes.size() - 3)), FormatError);  // Обрезан
+  ASSERT_THROW(load("LAB4" + bytes.substr(4)), FormatError);          // Сигнатура
+  Set<long long> wide;
+  stringstream wrongType(bytes);
+  ASSERT_THROW(wide.load(wrongType), FormatError);
+}
+
+// Образ для отображения в память: поиск, границы, отрезки и свёртка прямо по байтам файла
+TEST(Set, mapped_image) {
+  Set<int> a;
+  for (int i = 0; i < 50000; i++) a.insert(i * 7 % 50021 * 2);
+  string path = testing::TempDir() + "set_image.bin";
+  {
+    ofstream out(path, ios::binary);
+    a.saveImage(out);
+  }
+  MappedTree<int> m(path);
+  m.verify();
+  ASSERT_EQ((size_t)a.size(), m.size());
+  ASSERT_TRUE(equal(a.begin(), a.end(), m.begin(), m.end()));
+  for (int v : {-1, 0, 1, 2, 777, 778, 100040, 100041, 200000}) {
+    ASSERT_EQ(a.find(v), m.contains(v)) << v;
+    auto lb = m.lowerBound(v);
+    ASSERT_EQ(a.countLess(v), lb - m.begin()) << v;
+    if (lb != m.end()) {
+      ASSERT_LE(v, *lb);
+    }
+  }
+  ASSERT_EQ(vector<int>({10, 12, 14}), vector<int>(m.range(9, 15).begin(), m.range(9, 15).end()));
+  ASSERT_EQ(10 + 12 + 14, m.reduceRange(9, 15, sum, 0));
+  auto maximum = [](int x, int y) { return max(x, y); };
+  ASSERT_EQ(a.reduce(maximum), m.reduce(maximum));
+  ASSERT_EQ(m.upperBound(20), m.lowerBound(21));
+  // Итератор с произвольным доступом: работают стандартные алгоритмы
+  ASSERT_EQ((ptrdiff_t)m.size(), distance(m.begin(), m.end()));
+  auto found = lower_bound(m.begin(), m.end(), 777);
+  ASSERT_EQ(m.lowerBound(777), found);
+  ASSERT_TRUE(binary_search(m.begin(), m.end(), 100040));
+  auto last = m.end() - 1;
+  ASSERT_EQ(a.reduce(maximum), *last);
+  ASSERT_TRUE(m.begin() + 2 == 2 + m.begin());
+  last -= 1;
+  ASSERT_EQ(m.end() - 2, last);
+  ASSERT_TRUE(m.begin() <= last && last < m.end() && m.end() > last && m.end() >= m.end());
+  ASSERT_EQ(vector<int>(m.begin(), m.end()), vector<int>(a.begin(), a.end()));
+  remove(path.c_str());
+
+  // Образ в памяти; пустое дерево; испорченный образ
+  BinaryTree<double> tree{3.5, -1, 2};
+  stringstream image;
+  tree.saveImage(image);
+  string bytes = image.str();
+  vector<uint64_t> aligned(bytes.size() / 8 + 1);
+  memcpy(aligned.data(), bytes.data(), bytes.size());
+  MappedTree<double> md(aligned.data(), bytes.size());
+  md.verify();
+  ASSERT_EQ(vector<double>({-1, 2, 3.5}), vector<double>(md.begin(), md.end()));
+  ASSERT_EQ(nullptr, md.find(0));
+  ASSERT_THROW(MappedTree<int>(aligned.data(), bytes.size()), FormatError);  // Другой тип
+  ASSERT_THROW(MappedTree<double>(aligned.data(), bytes.size() - 1), FormatError);
+  reinterpret_cast<MappedNode<double> *>(reinterpret_cast<char *>(aligned.data()) + 32)[1].left = 1;
+  ASSERT_THROW(MappedTree<double>(aligned.data(), bytes.size()).verify(), FormatError);
+  Set<int> empty;
+  stringstream emptyImage;
+  empty.saveImage(emptyImage);
+  string emptyBytes = emptyImage.str();
+  MappedTree<int> me(emptyBytes.data(), emptyBytes.size());
+  ASSERT_EQ(0u, me.size());
+  ASSERT_EQ(me.end(), me.lowerBound(5));
+}
+
+// Общий интерфейс множеств: Set и SkipListSet взаимозаменяемы
+template <class S>
+void checkSetInterface() {
+  S a{5, 1, 3};
+  S b("3 4 5 6");
+  ASSERT_TRUE(a.insert(2));
+  ASSERT_FALSE(a.insert(3));
+  a.erase(1);
+  ASSERT_EQ("2 3 5", a.toString());
+  ASSERT_EQ(3, a.size());
+  ASSERT_TRUE(a.find(5));
+  ASSERT_FALSE(a.find(1));
+  ASSERT_EQ("2 3 4 5 6", a.setUnion(b).toString());
+  ASSERT_EQ("3 5", a.intersection(b).toString());
+  ASSERT_EQ("2", a.difference(b).toString());
+  ASSERT_EQ("4 9 25", a.map(square).toString());
+  ASSERT_EQ("2", a.where(isEven).toString());
+  ASSERT_EQ(10, a.reduce(sum));
+  ASSERT_TRUE(a.intersection(b).subSet(b));
+  ASSERT_TRUE(a.equal(S{5, 3, 2}));
+}
+
+// Множество на списке с пропусками: тот же интерфейс и работа из многих потоков
+TEST(Set, skip_list) {
+  checkSetInterface<Set<int>>();
+  checkSetInterface<SkipListSet<int>>();
+
+  SkipListSet<int> s;
+  set<int> check;
+  for (int i = 0; i < 5000; i++) {
+    int value = rand() % 1000;
+    if (rand() % 3 == 0)
+      ASSERT_EQ(check.erase(value) > 0, s.erase(value));
+    else
+      ASSERT_EQ(check.insert(value).second, s.insert(value));
+  }
+  ASSERT_EQ(check.size(), s.size());
+  ASSERT_TRUE(equal(check.begin(), check.end(), s.begin(), s.end()));
+
+  // Потоки вставляют свои ключи и удаляют нечётные из них; обход идёт одновременно
+  SkipListSet<int> shared;
+  const int THREADS = 4, KEYS = 5000;
+  vector<thread> workers;
+  for (int t = 0; t < THREADS; t++) {
+    workers.emplace_back([&shared, t] {
+      for (int i = 0; i < KEYS; i++) shared.insert(i * THREADS + t);
+      for (int i = 1; i < KEYS; i += 2) shared.erase(i * THREADS + t);
+    });
+  }
+  for (int scan = 0; scan < 5; scan++) ASSERT_TRUE(is_sorted(shared.begin(), shared.end()));
+  for (auto &w : workers) w.join();
+  vector<int> expected;
+  for (int i = 0; i < KEYS * THREADS; i++)
+    if ((i / THREADS) % 2 == 0) expected.push_back(i);
+  ASSERT_EQ(expected.size(), shared.size());
+  ASSERT_EQ(expected, vector<int>(shared.begin(), shared.end()));
+  SkipListSet<int> copy = shared;
+  ASSERT_TRUE(copy.equal(shared));
+
+  // Копия итератора на удалённый узел равна оригиналу и идёт дальше так же
+  SkipListSet<int> small{1, 2, 3};
+  auto it = small.begin();
+  ++it;
+  ASSERT_TRUE(small.erase(2));
+  auto copyIt = it;
+  ASSERT_TRUE(copyIt == it);
+  ASSERT_EQ(3, *++copyIt);
+  ASSERT_EQ(3, *++it);
+}
+
+// Множество, разбитое на шарды по диапазонам ключей: перебалансировка и работа из многих потоков
+TEST(Set, sharded) {
+  ShardedSet<int> small{5, 1, 3, 1};
+  ASSERT_EQ(3, small.size());
+  ASSERT_EQ("1 3 5", small.toString());
+  ASSERT_TRUE(small.find(3));
+  ASSERT_FALSE(small.erase(2));
+
+  // Ключи идут по возрастанию - вся нагрузка на последний шард, он должен делиться
+  ShardedSet<int> s(4);
+  set<int> check;
+  for (int i = 0; i < 20000; i++) {
+    ASSERT_TRUE(s.insert(i));
+    check.insert(i);
+  }
+  ASSERT_FALSE(s.insert(100));
+  s.check();
+  ASSERT_EQ(4, s.shardCount());
+  for (int size : s.shardSizes()) ASSERT_LE(size, 2 * 20000 / 4);
+  // Удаляем почти весь диапазон: опустевшие шарды сливаются с соседями
+  for (int i = 0; i < 19000; i++) {
+    ASSERT_TRUE(s.erase(i));
+    check.erase(i);
+  }
+  s.check();
+  ASSERT_LT(s.shardCount(), 4);
+  for (int size : s.shardSizes()) ASSERT_GE(size, 1000 / 8);
+  ASSERT_EQ(vector<int>(check.begin(), check.end()), vector<int>(s.begin(), s.end()));
+
+  // Потоки вставляют свои ключи и удаляют нечётные из них, деление и слияние идут одновременно
+  ShardedSet<int> shared(4);
+  const int THREADS = 4, KEYS = 5000;
+  vector<thread> workers;
+  for (int t = 0; t < THREADS; t++) {
+    workers.emplace_back([&shared, t] {
+      for (int i = 0; i < KEYS; i++) shared.insert(t * KEYS + i);
+      for (int i = 1; i < KEYS; i += 2) shared.erase(t * KEYS + i);
+    });
+  }
+  for (int scan = 0; scan < 5; scan++) {
+    vector<int> seen = shared.toVector();
+    ASSERT_TRUE(is_sorted(seen.begin(), seen.end()));
+  }
+  for (auto &w : workers) w.join();
+  shared.check();
+  vector<int> expected;
+  for (int i = 0; i < KEYS * THREADS; i += 2) expected.push_back(i);
+  ASSERT_EQ(expected.size(), shared.size());
+  ASSERT_EQ(expected, vector<int>(shared.begin(), shared.end()));
+}
+
 // Варианты реализации:
 // на базе бинарной кучи
 // на базе бинарного дерева поиска
@@ -470,6 +1599,17 @@ TEST(Set, string) {
 // IEnumerable, реализация TreeEnumerator
 // Перегрузка операторов
 
+// Несбалансированное n-арное дерево большой глубины
+TEST(Tree, deep_tree) {
+  Tree<int, 2> tree;
+  const int SIZE = 20000;
+  for (int value = 1; value <= SIZE; value++) tree.insert(value);
+  ASSERT_TRUE(tree.find(1));
+  ASSERT_TRUE(tree.find(SIZE));
+  ASSERT_FALSE(tree.find(SIZE + 1));
+  ASSERT_EQ(SIZE * (SIZE + 1) / 2, tree.reduce(sum));
+}
+
 // Базовые операции с деревом
 TEST(Tree, base_operations) {
   // int n = 2;  // Пусть будет бинарное дерево для начала
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Быстрый текстовый ввод-вывод значений: числа разбираются std::from_chars и печатаются std::to_chars -
+// без потоков и без локали. Остальные типы по-прежнему идут через операторы << и >>
+
+// Числа, которые печатаются и разбираются через <charconv> (символьные типы печатаются потоком как символы)
+template <class T>
+constexpr bool charconvText = std::is_floating_point<T>::value ||
+                              (std::is_integral<T>::value && !std::is_same<T, bool>::value &&
+                               !std::is_same<T, char>::value && !std::is_same<T, signed char>::value &&
+                               !std::is_same<T, unsigned char>::value);
+
+// Текст в одном растущем буфере; если задан поток, буфер сбрасывается в него блоками
+// Пробельные символы в начале и в конце вывода отбрасываются (как trim_copy), но без копирования строки:
+// пробелы придерживаются, пока за ними не появится что-то ещё
+class TextWriter {
+  static constexpr size_t FLUSH_SIZE = 1 << 16;
+  std::string buffer;
+  std::ostream *sink = nullptr;
+  std::string pendingSpace;  // Пробельные символы, которые ещё могут оказаться в конце вывода
+  bool started = false;      // Был ли уже непробельный вывод
+
+  void beforeText() {
+    if (!pendingSpace.empty()) {
+      buffer += pendingSpace;
+      pendingSpace.clear();
+    }
+    started = true;
+  }
+  void afterText() {
+    if (sink && buffer.size() >= FLUSH_SIZE) flush();
+  }
+
+ public:
+  TextWriter() = default;
+  explicit TextWriter(std::ostream &sink) : sink(&sink) {}
+  TextWriter(const TextWriter &) = delete;
+  TextWriter &operator=(const TextWriter &) = delete;
+  ~TextWriter() {
+    flush();
+  }
+  template <class T>
+  void value(const T &v) {
+    beforeText();
+    if constexpr (charconvText<T>) {
+      char digits[64];  // Хватает на любое число, включая double в кратчайшей точной записи
+      auto res = std::to_chars(digits, digits + sizeof(digits), v);
+      buffer.append(digits, res.ptr);
+    } else {
+      std::ostringstream ss;
+      ss << v;
+      buffer += ss.str();
+    }
+    afterText();
+  }
+  void put(char c) {
+    if (std::isspace((unsigned char)c)) {
+      if (started) pendingSpace += c;
+      return;
+    }
+    beforeText();
+    buffer += c;
+    afterText();
+  }
+  // Фрагмент текста целиком: пробелы в его начале и конце обрабатываются так же, как у put(char)
+  void put(const char *s, size_t length) {
+    const char *last = s + length, *end = last;
+    while (end != s && std::isspace((unsigned char)end[-1])) end--;
+    if (end == s) {  // Одни пробелы
+      if (started) pendingSpace.append(s, length);
+      return;
+    }
+    if (!started)
+      while (std::isspace((unsigned char)*s)) s++;
+    beforeText();
+    buffer.append(s, end);
+    pendingSpace.append(end, last);
+    afterText();
+  }
+  void put(const char *s) {
+    put(s, std::strlen(s));
+  }
+  // Сбросить накопленное в поток (без потока ничего не делает)
+  void flush() {
+    if (!sink) return;
+    sink->write(buffer.data(), buffer.size());
+    buffer.clear();
+  }
+  // Весь текст, если потока нет
+  std::string take() {
+    return std::move(buffer);
+  }
+};
+
+// Разбор значений, разделённых пробельными символами, в конец out
+// Как и цикл while (in >> value), останавливается на первом фрагменте, который не является значением
+template <class T>
+void parseValues(const char *first, const char *last, std::vector<T> &out) {
+  if constexpr (charconvText<T>) {
+    while (true) {
+      while (first != last && std::isspace((unsigned char)*first)) first++;
+      if (first != last && *first == '+') first++;  // from_chars не принимает явный плюс, а >> принимает
+      T value;
+      auto res = std::from_chars(first, last, value);
+      if (res.ec != std::errc()) return;
+      out.push_back(value);
+      first = res.ptr;
+    }
+  } else {
+    std::istringstream in(std::string(first, last));
+    T value;
+    while (in >> value) out.push_back(value);
+  }
+}
+template <class T>
+void parseValues(const char *str, std::vector<T> &out) {
+  parseValues(str, str + std::strlen(str), out);
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пул потоков с перехватом задач (work stealing) для параллелизма вида fork-join
+// У каждого рабочего потока своя очередь: свои задачи он кладёт и забирает с конца,
+// а освободившиеся потоки перехватывают задачи из начала чужих очередей.
+// Поток, ждущий перехваченную задачу, тем временем выполняет другие задачи
+class ThreadPool {
+  struct Task {
+    std::function<void()> run;
+    std::exception_ptr error;        // Исключение, выброшенное задачей
+    std::atomic<bool> done{false};   // Задача выполнена
+  };
+  struct Queue {
+    std::mutex m;
+    std::deque<Task *> tasks;
+  };
+  // Какому пулу и какой очереди принадлежит текущий поток
+  struct Worker {
+    ThreadPool *pool = nullptr;
+    size_t index = 0;
+  };
+  static Worker &current() {
+    static thread_local Worker worker;
+    return worker;
+  }
+
+  std::vector<std::unique_ptr<Queue>> queues;  // queues[0] - общая очередь для внешних потоков
+  std::vector<std::thread> workers;
+  std::atomic<bool> stopping{false};
+  std::atomic<int> queued{0};  // Сколько задач ждут в очередях
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+
+  size_t myQueue() {
+    Worker &w = current();
+    return w.pool == this ? w.index : 0;
+  }
+  void push(Task *task) {
+    Queue &q = *queues[myQueue()];
+    {
+      std::lock_guard<std::mutex> lock(q.m);
+      q.tasks.push_back(task);
+    }
+    {
+      // Под sleepMutex: иначе рабочий поток может проверить queued, пропустить notify и уснуть
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      queued++;
+    }
+    wake.notify_one();
+  }
+  // Забрать задачу обратно, если её ещё никто не перехватил
+  bool takeBack(Task *task) {
+    Queue &q = *queues[myQueue()];
+    std::lock_guard<std::mutex> lock(q.m);
+    auto it = std::find(q.tasks.rbegin(), q.tasks.rend(), task);
+    if (it == q.tasks.rend()) return false;
+    q.tasks.erase(std::next(it).base());
+    queued--;
+    return true;
+  }
+  // Взять задачу: сначала с конца своей очереди, затем из начала чужих
+  Task *take() {
+    size_t mine = myQueue();
+    {
+      Queue &q = *queues[mine];
+      std::lock_guard<std::mutex> lock(q.m);
+      if (!q.tasks.empty()) {
+        Task *t = q.tasks.back();
+        q.tasks.pop_back();
+        queued--;
+        return t;
+      }
+    }
+    for (size_t i = 1; i <= queues.size(); i++) {
+      Queue &q = *queues[(mine + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(q.m);
+      if (!q.tasks.empty()) {
+        Task *t = q.tasks.front();
+        q.tasks.pop_front();
+        queued--;
+        return t;
+      }
+    }
+    return nullptr;
+  }
+  static void execute(Task *task) {
+    try {
+      task->run();
+    } catch (...) {
+      task->error = std::current_exception();
+    }
+    task->done.store(true, std::memory_order_release);
+  }
+  // Выполнить одну чужую задачу, если она есть
+  bool runOne() {
+    Task *task = take();
+    if (task == nullptr) return false;
+    execute(task);
+    return true;
+  }
+  void workerLoop(size_t index) {
+    current() = Worker{this, index};
+    while (!stopping) {
+      if (runOne()) continue;
+      std::unique_lock<std::mutex> lock(sleepMutex);
+      wake.wait(lock, [this] { return queued > 0 || stopping; });
+    }
+  }
+
+ public:
+  // threads - количество рабочих потоков; при 0 всё выполняет вызывающий поток
+  explicit ThreadPool(size_t threads) {
+    for (size_t i = 0; i <= threads; i++) queues.push_back(std::make_unique<Queue>());
+    for (size_t i = 1; i <= threads; i++) workers.emplace_back([this, i] { workerLoop(i); });
+  }
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto &t : workers) t.join();
+  }
+  // Общий пул: по рабочему потоку на каждое ядро, кроме вызывающего
+  static ThreadPool &instance() {
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+  }
+  // Количество рабочих потоков
+  size_t size() const {
+    return workers.size();
+  }
+  // Выполнить f1 и f2, возможно параллельно, и дождаться обеих
+  template <class F1, class F2>
+  void invoke(F1 &&f1, F2 &&f2) {
+    if (workers.empty()) {
+      f1();
+      f2();
+      return;
+    }
+    Task task;
+    task.run = [&f2] { f2(); };
+    push(&task);  // f2 может перехватить другой поток
+    std::exception_ptr error;
+    try {
+      f1();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    if (takeBack(&task)) {  // Никто не перехватил => выполняем сами
+      execute(&task);
+    } else {  // Пока ждём, помогаем выполнять другие задачи
+      while (!task.done.load(std::memory_order_acquire)) {
+        if (!runOne()) std::this_thread::yield();
+      }
+    }
+    if (error) std::rethrow_exception(error);
+    if (task.error) std::rethrow_exception(task.error);
+  }
+};
+
+// Параллельная сортировка слиянием: половины сортируются на пуле потоков, затем сливаются
+template <class It, class Compare = std::less<>>
+void parallelSort(It first, It last, ThreadPool &threads, Compare comp = Compare()) {
+  const std::ptrdiff_t CUTOFF = 1 << 14;  // Меньшие части сортируем последовательно
+  if (last - first <= CUTOFF || threads.size() == 0) {
+    std::sort(first, last, comp);
+    return;
+  }
+  It middle = first + (last - first) / 2;
+  threads.invoke([&] { parallelSort(first, middle, threads, comp); },
+                 [&] { parallelSort(middle, last, threads, comp); });
+  std::inplace_merge(first, middle, last, comp);
+}
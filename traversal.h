@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cassert>
+#include <type_traits>
+
+// Обходы двоичного дерева без рекурсии и без выделения памяти
+// Порядок задаётся параметром шаблона, посетитель - любой вызываемый объект, поэтому его вызов встраивается.
+// Посетитель может вернуть bool: false - остановить обход. Узлу нужны поля left и right
+enum class Order { NLR, NRL, LRN, LNR, RLN, RNL };
+
+// Порядок, заданный строкой из трёх букв ("LNR"); false - если строка не задаёт порядок
+inline bool parseOrder(const char *s, Order &order) {
+  static const char *const names[] = {"NLR", "NRL", "LRN", "LNR", "RLN", "RNL"};
+  for (int i = 0; i < 6; i++) {
+    const char *name = names[i];
+    if (s[0] == name[0] && s[1] == name[1] && s[2] == name[2] && s[3] == 0) {
+      order = (Order)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Вызов посетителя: результат void считается продолжением обхода
+template <class Visit, class Node>
+bool visitNode(Visit &visit, Node *n) {
+  if constexpr (std::is_void<decltype(visit(n))>::value) {
+    visit(n);
+    return true;
+  } else {
+    return visit(n);
+  }
+}
+
+// Итеративный обход со стеком на MaxDepth указателей (на стеке вызова). Возвращает false, если посетитель
+// остановил обход. Зеркальные порядки (NRL для NLR и т.д.) - тот же цикл с переставленными потомками:
+// first - поддерево, которое обходится раньше, second - позже
+template <Order order, int MaxDepth = 64, class Node, class Visit>
+bool traverse(Node *root, Visit &&visit) {
+  constexpr bool forward = order == Order::NLR || order == Order::LNR || order == Order::LRN;
+  auto first = [](Node *n) { return forward ? n->left : n->right; };
+  auto second = [](Node *n) { return forward ? n->right : n->left; };
+  Node *stack[MaxDepth];
+  int depth = 0;
+  Node *n = root;
+  if constexpr (order == Order::NLR || order == Order::NRL) {
+    // В стеке - вторые поддеревья, до которых ещё не дошли
+    while (true) {
+      for (; n != nullptr; n = first(n)) {
+        if (!visitNode(visit, n)) return false;
+        if (second(n) != nullptr) {
+          assert(depth < MaxDepth);
+          stack[depth++] = second(n);
+        }
+      }
+      if (depth == 0) return true;
+      n = stack[--depth];
+    }
+  } else if constexpr (order == Order::LNR || order == Order::RNL) {
+    // В стеке - узлы, у которых обходится первое поддерево
+    while (true) {
+      for (; n != nullptr; n = first(n)) {
+        assert(depth < MaxDepth);
+        stack[depth++] = n;
+      }
+      if (depth == 0) return true;
+      n = stack[--depth];
+      if (!visitNode(visit, n)) return false;
+      n = second(n);
+    }
+  } else {
+    // В стеке - путь от корня; last - последний посещённый узел: если это второй потомок вершины стека,
+    // оба её поддерева пройдены
+    Node *last = nullptr;
+    while (true) {
+      for (; n != nullptr; n = first(n)) {
+        assert(depth < MaxDepth);
+        stack[depth++] = n;
+      }
+      if (depth == 0) return true;
+      Node *top = stack[depth - 1];
+      if (second(top) != nullptr && second(top) != last) {
+        n = second(top);
+      } else {
+        if (!visitNode(visit, top)) return false;
+        last = top;
+        depth--;
+      }
+    }
+  }
+}
+
+// Симметричный обход Морриса (LNR или RNL) за O(1) памяти при любой высоте дерева:
+// у предшественника временно подменяется пустая ссылка на потомка, на втором проходе она восстанавливается.
+// Дерево на время обхода меняется - нельзя одновременно читать его из других потоков.
+// При остановке посетителем обход доходит до конца без вызовов посетителя, чтобы восстановить все ссылки
+template <Order order, class Node, class Visit>
+bool traverseMorris(Node *root, Visit &&visit) {
+  static_assert(order == Order::LNR || order == Order::RNL, "Обход Морриса - только симметричный");
+  constexpr bool forward = order == Order::LNR;
+  auto first = [](Node *n) -> Node *& { return forward ? n->left : n->right; };
+  auto second = [](Node *n) -> Node *& { return forward ? n->right : n->left; };
+  bool running = true;
+  Node *n = root;
+  while (n != nullptr) {
+    if (first(n) == nullptr) {
+      if (running) running = visitNode(visit, n);
+      n = second(n);
+      continue;
+    }
+    Node *pred = first(n);  // Предшественник n - крайний узел первого поддерева
+    while (second(pred) != nullptr && second(pred) != n) pred = second(pred);
+    if (second(pred) == nullptr) {  // Первый приход: пришиваем предшественника к n и спускаемся
+      second(pred) = n;
+      n = first(n);
+    } else {  // Второй приход: первое поддерево пройдено, снимаем временную ссылку
+      second(pred) = nullptr;
+      if (running) running = visitNode(visit, n);
+      n = second(n);
+    }
+  }
+  return running;
+}
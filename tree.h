@@ -2,6 +2,7 @@
 
 #include <cwchar>
 #include <iostream>
+#include <vector>
 
 // == АТД (абстрактные типы данных) ==
 
@@ -18,14 +19,18 @@ class Tree {
     explicit Node(T value) : value(value) {
       for (int i = 0; i < N; i++) child[i] = nullptr;
     }
+    // Поиск без рекурсии: дерево не сбалансировано, его глубина может быть порядка n
     bool find(T v) {
-      if (v == this->value) {
-        return true;
-      }
-      for (int i = 0; i < N; i++) {
-        if (child[i] && child[i]->find(v)) {
+      std::vector<Node *> stack{this};
+      while (!stack.empty()) {
+        Node *n = stack.back();
+        stack.pop_back();
+        if (v == n->value) {
           return true;
         }
+        for (int i = 0; i < N; i++) {
+          if (n->child[i]) stack.push_back(n->child[i]);
+        }
       }
       return false;
     }
@@ -33,6 +38,21 @@ class Tree {
   Node *root = nullptr;  // Корень дерева
  public:
   explicit Tree() = default;
+  Tree(const Tree &) = delete;
+  Tree &operator=(const Tree &) = delete;
+  // Удаление всех узлов без рекурсии
+  ~Tree() {
+    std::vector<Node *> stack;
+    if (root) stack.push_back(root);
+    while (!stack.empty()) {
+      Node *n = stack.back();
+      stack.pop_back();
+      for (int i = 0; i < N; i++) {
+        if (n->child[i]) stack.push_back(n->child[i]);
+      }
+      delete n;
+    }
+  }
   // Вставка элемента
   void insert(T value) {
     // Создаём новый узел дерева
@@ -44,18 +64,15 @@ class Tree {
     }
   }
   Node *insert(Node *r, Node *newNode) {
-    // Вставляем на ближайшее пустое место
-    int idx = 0;
-    for (int i = 0; i < N; i++) {
-      if (r->child[i]) {
-        idx = i;
-      } else {
-        r->child[i] = newNode;
-        return r;
+    // Вставляем на ближайшее пустое место, если мест нет - спускаемся в последнего ребёнка
+    for (Node *n = r;; n = n->child[N - 1]) {
+      for (int i = 0; i < N; i++) {
+        if (!n->child[i]) {
+          n->child[i] = newNode;
+          return r;
+        }
       }
     }
-    r->child[idx] = insert(r->child[idx], newNode);
-    return r;
   }
   // Поиск элемента по значению
   bool find(T value) {
@@ -64,34 +81,68 @@ class Tree {
     }
     return root->find(value);
   }
+  // Обход Корень-Дети без рекурсии: visit(значение) для каждого узла
+  template <class Visit>
+  void forEach(Visit &visit) const {
+    std::vector<Node *> stack;
+    if (root) stack.push_back(root);
+    while (!stack.empty()) {
+      Node *n = stack.back();
+      stack.pop_back();
+      visit(n->value);
+      for (int i = N - 1; i >= 0; i--) {
+        if (n->child[i]) stack.push_back(n->child[i]);
+      }
+    }
+  }
   // map - применение функции к каждому элементу дерево
-  // Создаётся новое дерево
+  // Создаётся новое дерево, значения вставляются в порядке обхода Корень-Дети
   Tree<T, N> *map(T (*f)(T)) {
+    return map<T (*)(T)>(f);
+  }
+  // f - любая вызываемая сущность, в т.ч. лямбда с состоянием
+  template <class F>
+  Tree<T, N> *map(F f) {
     auto *res = new Tree<T, N>;
-    // for (T x : *this) {
-    //   res->insert(f(x));
-    // }
+    auto visit = [&](const T &x) { res->insert(f(x)); };
+    forEach(visit);
     return res;
   }
   // where фильтрует значения из списка l с помощью функции-фильтра h
   Tree<T, N> *where(bool (*h)(T)) {
+    return where<bool (*)(T)>(h);
+  }
+  template <class H>
+  Tree<T, N> *where(H h) {
     auto *res = new Tree<T, N>;
-    // for (T x : *this) {
-    //   if (h(x)) {
-    //     res->insert(x);
-    //   }
-    // }
+    auto visit = [&](const T &x) {
+      if (h(x)) res->insert(x);
+    };
+    forEach(visit);
     return res;
   }
   // reduce - применяем к каждой паре значений пока не получим одно значение
   T reduce(T (*f)(T, T)) {
     return reduce(root, f);
   }
-  T reduce(Node *n, T (*f)(T, T)) {
+  template <class F>
+  T reduce(F f) {
+    return reduce(root, f);
+  }
+  // Свёртка в порядке обхода Корень-Дети без рекурсии
+  template <class F>
+  T reduce(Node *n, F f) {
     T value = n->value;
-    for (int i = 0; i < N; i++) {
-      if (n->child[i]) {
-        value = f(value, reduce(n->child[i], f));
+    std::vector<Node *> stack;
+    for (int i = N - 1; i >= 0; i--) {
+      if (n->child[i]) stack.push_back(n->child[i]);
+    }
+    while (!stack.empty()) {
+      Node *c = stack.back();
+      stack.pop_back();
+      value = f(value, c->value);
+      for (int i = N - 1; i >= 0; i--) {
+        if (c->child[i]) stack.push_back(c->child[i]);
       }
     }
     return value;